@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// Fixed-capacity FIFO ring of cells for propagation. A cell is in the queue at most once, a
+// second Push while it waits is dropped, so cellCount slots always suffice and Push and Pop
+// never allocate.
+class CellQueue {
+public:
+	void Resize(int cellCount) {
+		this->cells.assign(cellCount, 0);
+		this->queued.assign(cellCount, 0);
+		this->head = 0;
+		this->size = 0;
+	}
+	bool Empty() const { return this->size == 0; }
+	void Push(int cell) {
+		if (this->queued[cell]) return;
+		this->queued[cell] = 1;
+		int tail = this->head + this->size;
+		if (tail >= static_cast<int>(this->cells.size())) tail -= static_cast<int>(this->cells.size());
+		this->cells[tail] = cell;
+		this->size++;
+	}
+	int Pop() {
+		int cell = this->cells[this->head];
+		if (++this->head == static_cast<int>(this->cells.size())) this->head = 0;
+		this->size--;
+		this->queued[cell] = 0;
+		return cell;
+	}
+	// Drop whatever is still queued, e.g. after a contradiction
+	void Clear() {
+		while (!Empty()) Pop();
+	}
+
+private:
+	std::vector<int> cells;
+	std::vector<uint8_t> queued; // by cell
+	int head = 0;
+	int size = 0;
+};
@@ -0,0 +1,102 @@
+#include "EntropyHeap.h"
+
+void EntropyHeap::Build(const std::vector<EntropyKey>& keys)
+{
+	int cellCount = static_cast<int>(keys.size());
+	this->keys = keys;
+	this->heap.resize(cellCount);
+	this->slots.resize(cellCount);
+	for (int cell = 0; cell < cellCount; ++cell) {
+		this->heap[cell] = cell;
+		this->slots[cell] = cell;
+	}
+	for (int slot = cellCount / 2 - 1; slot >= 0; --slot) {
+		SiftDown(slot);
+	}
+}
+
+void EntropyHeap::Clear(int cellCount)
+{
+	if (static_cast<int>(this->slots.size()) != cellCount) {
+		this->slots.assign(cellCount, -1);
+		this->keys.resize(cellCount);
+	}
+	else {
+		for (int cell : this->heap) {
+			this->slots[cell] = -1;
+		}
+	}
+	this->heap.clear();
+}
+
+void EntropyHeap::Update(int cell, EntropyKey key)
+{
+	EntropyKey oldKey = this->keys[cell];
+	this->keys[cell] = key;
+	int slot = this->slots[cell];
+	if (slot < 0) {
+		this->heap.push_back(cell);
+		this->slots[cell] = static_cast<int>(this->heap.size()) - 1;
+		SiftUp(this->slots[cell]);
+	}
+	else if (key < oldKey) {
+		SiftUp(slot);
+	}
+	else {
+		SiftDown(slot);
+	}
+}
+
+void EntropyHeap::Remove(int cell)
+{
+	int slot = this->slots[cell];
+	if (slot < 0) return;
+
+	int last = this->heap.back();
+	this->heap.pop_back();
+	this->slots[cell] = -1;
+	if (last == cell) return;
+
+	Place(slot, last);
+	SiftUp(slot);
+	SiftDown(this->slots[last]);
+}
+
+// Privates
+
+void EntropyHeap::Place(int slot, int cell)
+{
+	this->heap[slot] = cell;
+	this->slots[cell] = slot;
+}
+
+void EntropyHeap::SiftUp(int slot)
+{
+	int cell = this->heap[slot];
+	EntropyKey key = this->keys[cell];
+	while (slot > 0) {
+		int parent = (slot - 1) / 2;
+		if (!(key < this->keys[this->heap[parent]])) break;
+		Place(slot, this->heap[parent]);
+		slot = parent;
+	}
+	Place(slot, cell);
+}
+
+void EntropyHeap::SiftDown(int slot)
+{
+	int size = static_cast<int>(this->heap.size());
+	int cell = this->heap[slot];
+	EntropyKey key = this->keys[cell];
+	while (true) {
+		int child = slot * 2 + 1;
+		if (child >= size) break;
+		if (child + 1 < size && this->keys[this->heap[child + 1]] < this->keys[this->heap[child]]) {
+			++child;
+		}
+		if (!(this->keys[this->heap[child]] < key)) break;
+		Place(slot, this->heap[child]);
+		slot = child;
+	}
+	Place(slot, cell);
+}
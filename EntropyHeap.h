@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Heap order of a cell: lowest entropy first, equal entropies by the tie-break rank. Ranks are
+// distinct, so no two cells ever compare equal.
+struct EntropyKey {
+	float entropy;
+	uint32_t tieBreak;
+
+	bool operator<(const EntropyKey& other) const {
+		return this->entropy < other.entropy || (this->entropy == other.entropy && this->tieBreak < other.tieBreak);
+	}
+};
+
+// Indexed binary min-heap of cells keyed by entropy. Cells can be re-keyed or removed in
+// O(log n) through a cell -> heap slot table, and the lowest entropy cell is always at the top.
+class EntropyHeap {
+public:
+	// Fill the heap with cells 0..keys.size()-1 in O(n)
+	void Build(const std::vector<EntropyKey>& keys);
+	// Empty the heap for cellCount cells, O(cells queued) when the cell count is unchanged
+	void Clear(int cellCount);
+	void Update(int cell, EntropyKey key);
+	void Remove(int cell);
+	bool Empty() const { return this->heap.empty(); }
+	int Top() const { return this->heap[0]; }
+	EntropyKey TopKey() const { return this->keys[this->heap[0]]; }
+
+private:
+	std::vector<int> heap; // cells
+	std::vector<int> slots; // cell -> index in heap, -1 when not queued
+	std::vector<EntropyKey> keys; // by cell
+
+	void SiftUp(int slot);
+	void SiftDown(int slot);
+	void Place(int slot, int cell);
+};
@@ -0,0 +1,171 @@
+#include "ImageTileSet.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include "stb_image.h"
+
+static constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+
+static uint64_t Round(uint64_t lane, uint64_t word) {
+	lane += word * PRIME_2;
+	lane = (lane << 31) | (lane >> 33);
+	return lane * PRIME_1;
+}
+
+// Hash of a block of rows rowBytes long, stride bytes apart. The words of each row are spread over
+// four independent lanes so consecutive rounds don't wait on each other and the loop vectorises.
+static uint64_t BlockHash(const unsigned char* block, size_t stride, size_t rowBytes, int rows) {
+	uint64_t lanes[4] = { PRIME_1 + PRIME_2, PRIME_2, 0, 0 - PRIME_1 };
+	for (int row = 0; row < rows; ++row) {
+		const unsigned char* bytes = block + row * stride;
+		size_t i = 0;
+		for (; i + 32 <= rowBytes; i += 32) {
+			uint64_t words[4];
+			std::memcpy(words, bytes + i, 32);
+			for (int lane = 0; lane < 4; ++lane) {
+				lanes[lane] = Round(lanes[lane], words[lane]);
+			}
+		}
+		for (int lane = 0; i < rowBytes; i += 8, ++lane) {
+			uint64_t word = 0;
+			std::memcpy(&word, bytes + i, std::min<size_t>(8, rowBytes - i));
+			lanes[lane] = Round(lanes[lane], word);
+		}
+	}
+
+	uint64_t hash = ((lanes[0] << 1) | (lanes[0] >> 63)) + ((lanes[1] << 7) | (lanes[1] >> 57)) +
+		((lanes[2] << 12) | (lanes[2] >> 52)) + ((lanes[3] << 18) | (lanes[3] >> 46));
+	hash ^= hash >> 33;
+	hash *= PRIME_2;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+ImageTileSet ImageTileSet::Load(const std::string& filename, int tileSize, int threadCount)
+{
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+	if (!pixels) {
+		throw std::runtime_error("Could not load image: " + filename);
+	}
+	ImageTileSet tileSet = FromPixels(pixels, width, height, channels, tileSize, threadCount);
+	stbi_image_free(pixels);
+	return tileSet;
+}
+
+ImageTileSet ImageTileSet::FromPixels(const unsigned char* pixels, int width, int height, int channels, int tileSize, int threadCount)
+{
+	if (tileSize <= 0) {
+		throw std::runtime_error("Tile size must be positive");
+	}
+
+	ImageTileSet tileSet;
+	tileSet.tileSize = tileSize;
+	tileSet.channels = channels;
+	tileSet.sampleWidth = width / tileSize;
+	tileSet.sampleHeight = height / tileSize;
+	const int blockCount = tileSet.sampleWidth * tileSet.sampleHeight;
+	const size_t stride = static_cast<size_t>(width) * channels;
+	const size_t rowBytes = static_cast<size_t>(tileSize) * channels;
+	auto blockPixels = [&](int block) {
+		return pixels + static_cast<size_t>(block / tileSet.sampleWidth) * tileSize * stride + (block % tileSet.sampleWidth) * rowBytes;
+	};
+
+	// Hash every block, rows of blocks split across threads
+	std::vector<uint64_t> hashes(blockCount);
+	auto hashRows = [&](int begin, int end) {
+		for (int block = begin * tileSet.sampleWidth; block < end * tileSet.sampleWidth; ++block) {
+			hashes[block] = BlockHash(blockPixels(block), stride, rowBytes, tileSize);
+		}
+	};
+	if (threadCount <= 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threadCount = std::max(1, std::min(threadCount, tileSet.sampleHeight));
+	if (threadCount == 1) {
+		hashRows(0, tileSet.sampleHeight);
+	}
+	else {
+		std::vector<std::thread> threads;
+		for (int t = 0; t < threadCount; ++t) {
+			threads.emplace_back(hashRows, tileSet.sampleHeight * t / threadCount, tileSet.sampleHeight * (t + 1) / threadCount);
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	// Blocks with the same pixels are the same tile. The hash finds the first tile with it and
+	// sameHash chains any others, the pixels are compared before a tile is reused.
+	std::unordered_map<uint64_t, int> ids;
+	std::vector<int> sameHash; // by tile, next tile with the same hash, -1 at the end
+	auto samePixels = [&](int tile, const unsigned char* source) {
+		const unsigned char* stored = tileSet.TilePixels(tile);
+		for (int row = 0; row < tileSize; ++row) {
+			if (std::memcmp(stored + row * rowBytes, source + row * stride, rowBytes) != 0) return false;
+		}
+		return true;
+	};
+	tileSet.sample.resize(blockCount);
+	for (int block = 0; block < blockCount; ++block) {
+		const unsigned char* source = blockPixels(block);
+		auto [it, added] = ids.try_emplace(hashes[block], tileSet.TileCount());
+		int tile = it->second;
+		if (!added) {
+			int last = tile;
+			for (; tile >= 0 && !samePixels(tile, source); tile = sameHash[tile]) {
+				last = tile;
+			}
+			if (tile < 0) {
+				tile = tileSet.TileCount();
+				sameHash[last] = tile;
+				added = true;
+			}
+		}
+		if (added) {
+			for (int row = 0; row < tileSize; ++row) {
+				tileSet.tilePixels.insert(tileSet.tilePixels.end(), source + row * stride, source + row * stride + rowBytes);
+			}
+			tileSet.weights.push_back(0.0);
+			sameHash.push_back(-1);
+		}
+		tileSet.sample[block] = tile;
+		tileSet.weights[tile] += 1.0;
+	}
+
+	// Every east and south neighbour pair in the sample, and the same pair seen from the other side,
+	// packed as (tile, direction, neighbour) so duplicates sort together
+	std::vector<uint64_t> pairs;
+	pairs.reserve(static_cast<size_t>(blockCount) * 4);
+	auto addPair = [&](int tile, Direction dir, int neighbor) {
+		pairs.push_back((static_cast<uint64_t>(tile) << 34) | (static_cast<uint64_t>(dir) << 32) | static_cast<uint32_t>(neighbor));
+	};
+	for (int y = 0; y < tileSet.sampleHeight; ++y) {
+		for (int x = 0; x < tileSet.sampleWidth; ++x) {
+			int tile = tileSet.sample[y * tileSet.sampleWidth + x];
+			if (x + 1 < tileSet.sampleWidth) {
+				int east = tileSet.sample[y * tileSet.sampleWidth + x + 1];
+				addPair(tile, Direction::EAST, east);
+				addPair(east, Direction::WEST, tile);
+			}
+			if (y + 1 < tileSet.sampleHeight) {
+				int south = tileSet.sample[(y + 1) * tileSet.sampleWidth + x];
+				addPair(tile, Direction::SOUTH, south);
+				addPair(south, Direction::NORTH, tile);
+			}
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+	for (uint64_t pair : pairs) {
+		int tile = static_cast<int>(pair >> 34);
+		Direction dir = static_cast<Direction>((pair >> 32) & 3);
+		tileSet.adjacencyRules[{ tile, dir }].push_back(static_cast<int>(pair & 0xFFFFFFFF));
+	}
+
+	tileSet.rules = RuleSet::Compile(tileSet.adjacencyRules, tileSet.TileCount(), tileSet.weights);
+	return tileSet;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "RuleSet.h"
+
+// Simple tiled model learned from a sample image cut into tileSize x tileSize blocks. Every
+// distinct block is a tile weighted by how often it occurs, and two tiles may be neighbours in a
+// direction if they are neighbours that way somewhere in the sample. Tile ids follow the order
+// blocks are first seen, scanning the sample row by row.
+class ImageTileSet {
+public:
+	int tileSize = 0;
+	int channels = 0;
+	std::vector<unsigned char> tilePixels; // TileBytes() per tile, row-major
+	std::vector<double> weights;
+	// Tile id of every block of the sample, row-major, sampleWidth x sampleHeight blocks
+	int sampleWidth = 0;
+	int sampleHeight = 0;
+	std::vector<int> sample;
+	AdjacencyRules adjacencyRules;
+	std::shared_ptr<const RuleSet> rules; // compiled from adjacencyRules and weights
+
+	// Decode an image with stb_image and learn its tiles, throws std::runtime_error if it can't be read
+	static ImageTileSet Load(const std::string& filename, int tileSize, int threadCount = 0);
+	// Learn the tiles of width x height pixels of channels bytes each. Pixels past the last whole
+	// block on the right and bottom edges are ignored. Blocks are hashed in parallel, threadCount
+	// 0 uses every core.
+	static ImageTileSet FromPixels(const unsigned char* pixels, int width, int height, int channels, int tileSize, int threadCount = 0);
+
+	int TileCount() const { return static_cast<int>(this->weights.size()); }
+	size_t TileBytes() const { return static_cast<size_t>(this->tileSize) * this->tileSize * this->channels; }
+	const unsigned char* TilePixels(int tile) const { return &this->tilePixels[tile * TileBytes()]; }
+};
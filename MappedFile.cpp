@@ -0,0 +1,76 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::string& filename)
+{
+	std::shared_ptr<MappedFile> mappedFile(new MappedFile());
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+	mappedFile->file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) return nullptr;
+	mappedFile->size = static_cast<size_t>(size.QuadPart);
+	if (mappedFile->size == 0) return mappedFile; // empty files can't be mapped
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) return nullptr;
+	mappedFile->mapping = mapping;
+
+	mappedFile->data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (mappedFile->data == nullptr) return nullptr;
+	return mappedFile;
+}
+
+MappedFile::~MappedFile()
+{
+	if (this->data != nullptr) UnmapViewOfFile(this->data);
+	if (this->mapping != nullptr) CloseHandle(this->mapping);
+	if (this->file != nullptr) CloseHandle(this->file);
+}
+
+#else
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	std::shared_ptr<MappedFile> mappedFile(new MappedFile());
+	mappedFile->size = static_cast<size_t>(status.st_size);
+	if (mappedFile->size > 0) {
+		void* data = mmap(nullptr, mappedFile->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return nullptr;
+		}
+		mappedFile->data = static_cast<const char*>(data);
+	}
+	close(fd); // the mapping stays valid without the descriptor
+	return mappedFile;
+}
+
+MappedFile::~MappedFile()
+{
+	if (this->data != nullptr) munmap(const_cast<char*>(this->data), this->size);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped when the last reference goes away.
+// MapViewOfFile under _WIN32, mmap everywhere else.
+class MappedFile {
+public:
+	// nullptr if the file cannot be opened or mapped
+	static std::shared_ptr<const MappedFile> Open(const std::string& filename);
+
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* Data() const { return this->data; }
+	size_t Size() const { return this->size; }
+
+private:
+	MappedFile() = default;
+
+	const char* data = nullptr; // nullptr for an empty file
+	size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr; // HANDLEs, kept as void* so users of this header don't pull in windows.h
+	void* mapping = nullptr;
+#endif
+};
@@ -4,8 +4,118 @@
 #include <string>
 #include <print>
 #include <iostream>
+#include <stdexcept>
+#include <bit>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <filesystem>
+#include "MappedFile.h"
 
-std::vector<std::string> getGridFromFile(std::string filename) {
+// Two 31 bit polynomial hashes per window (one per modulus) packed into 64 bits. Rows are hashed
+// with ROW_BASE and the row hashes are combined down the columns with COLUMN_BASE.
+constexpr uint64_t HASH_MOD[2] = { 2147483647, 2147483629 };
+constexpr uint64_t ROW_BASE[2] = { 131, 137 };
+constexpr uint64_t COLUMN_BASE[2] = { 1000003, 1000033 };
+
+static uint64_t PowMod(uint64_t base, int exponent, uint64_t mod) {
+    uint64_t result = 1;
+    for (int i = 0; i < exponent; ++i) {
+        result = result * base % mod;
+    }
+    return result;
+}
+
+static uint64_t HashSlot(uint64_t hash, size_t slotCount) {
+    return (hash * 0x9E3779B97F4A7C15ULL) >> (64 - std::countr_zero(slotCount));
+}
+
+int PatternTable::Find(uint64_t hash, const char* block) const
+{
+    if (this->slots.empty()) return -1;
+    size_t mask = this->slots.size() - 1;
+    for (size_t slot = HashSlot(hash, this->slots.size()); ; slot = (slot + 1) & mask) {
+        int pattern = this->slots[slot];
+        if (pattern < 0) return -1;
+        if (this->hashes[pattern] == hash && std::memcmp(Pattern(pattern), block, static_cast<size_t>(this->N) * this->N) == 0) return pattern;
+    }
+}
+
+// Equal hashes are only a hint, same(pattern) confirms the chars match. Patterns that collide
+// keep probing, so they get separate slots like any other pair of hashes sharing a slot.
+template <typename Same>
+int PatternTable::FindOrAdd(uint64_t hash, Same same, bool& added)
+{
+    added = false;
+    if ((this->hashes.size() + 1) * 2 > this->slots.size()) {
+        Grow();
+    }
+    size_t mask = this->slots.size() - 1;
+    size_t slot = HashSlot(hash, this->slots.size());
+    for (; this->slots[slot] >= 0; slot = (slot + 1) & mask) {
+        if (this->hashes[this->slots[slot]] == hash && same(this->slots[slot])) return this->slots[slot];
+    }
+
+    added = true;
+    int pattern = PatternCount();
+    this->slots[slot] = pattern;
+    this->hashes.push_back(hash);
+    this->frequencies.push_back(0);
+    return pattern;
+}
+
+int PatternTable::Insert(uint64_t hash, const std::vector<std::string>& grid, int x, int y)
+{
+    int width = static_cast<int>(grid[0].size());
+    int height = static_cast<int>(grid.size());
+    auto same = [&](int pattern) {
+        const char* chars = Pattern(pattern);
+        for (int dy = 0; dy < this->N; ++dy) {
+            const std::string& row = grid[(y + dy) % height];
+            for (int dx = 0; dx < this->N; ++dx) {
+                if (*chars++ != row[(x + dx) % width]) return false;
+            }
+        }
+        return true;
+    };
+    bool added;
+    int pattern = FindOrAdd(hash, same, added);
+    if (!added) return pattern;
+
+    for (int dy = 0; dy < this->N; ++dy) {
+        const std::string& row = grid[(y + dy) % height];
+        for (int dx = 0; dx < this->N; ++dx) {
+            this->patterns.push_back(row[(x + dx) % width]);
+        }
+    }
+    return pattern;
+}
+
+int PatternTable::Insert(uint64_t hash, const char* block)
+{
+    auto same = [&](int pattern) { return std::memcmp(Pattern(pattern), block, static_cast<size_t>(this->N) * this->N) == 0; };
+    bool added;
+    int pattern = FindOrAdd(hash, same, added);
+    if (added) {
+        this->patterns.insert(this->patterns.end(), block, block + this->N * this->N);
+    }
+    return pattern;
+}
+
+void PatternTable::Grow()
+{
+    std::vector<int> oldSlots = std::move(this->slots);
+    this->slots.assign(oldSlots.empty() ? 64 : oldSlots.size() * 2, -1);
+    size_t mask = this->slots.size() - 1;
+    for (int pattern : oldSlots) {
+        if (pattern < 0) continue;
+        size_t slot = HashSlot(this->hashes[pattern], this->slots.size());
+        while (this->slots[slot] >= 0) slot = (slot + 1) & mask;
+        this->slots[slot] = pattern;
+    }
+}
+
+std::vector<std::string> PreProcess::getGridFromFile(std::string filename) {
 
     std::ifstream file(filename);
     if (!file) {
@@ -16,17 +126,398 @@ std::vector<std::string> getGridFromFile(std::string filename) {
 
     std::string line;
     while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
         if (!line.empty()) {
             grid.push_back(line);
         }
     }
+    return grid;
+}
+
+uint64_t PreProcess::PatternHash(const char* block, int N)
+{
+    uint64_t hash[2] = { 0, 0 };
+    for (int m = 0; m < 2; ++m) {
+        for (int dy = 0; dy < N; ++dy) {
+            uint64_t rowHash = 0;
+            for (int dx = 0; dx < N; ++dx) {
+                rowHash = (rowHash * ROW_BASE[m] + static_cast<unsigned char>(block[dy * N + dx])) % HASH_MOD[m];
+            }
+            hash[m] = (hash[m] * COLUMN_BASE[m] + rowHash) % HASH_MOD[m];
+        }
+    }
+    return (hash[0] << 32) | hash[1];
+}
+
+bool PreProcess::ParseLevel(const char* data, size_t size, std::vector<std::string>& grid, std::string& error)
+{
+    grid.clear();
+    size_t width = 0;
+    for (size_t start = 0; start < size; ) {
+        const char* end = static_cast<const char*>(std::memchr(data + start, '\n', size - start));
+        size_t length = (end ? end - data : size) - start;
+        size_t next = start + length + 1;
+        if (length > 0 && data[start + length - 1] == '\r') --length;
+        if (length > 0) {
+            for (size_t i = start; i < start + length; ++i) {
+                unsigned char c = static_cast<unsigned char>(data[i]);
+                if (c <= ' ' || c > '~') {
+                    error = "line " + std::to_string(grid.size() + 1) + " has a character that is not a tile";
+                    return false;
+                }
+            }
+            if (grid.empty()) width = length;
+            if (length != width) {
+                error = "line " + std::to_string(grid.size() + 1) + " is " + std::to_string(length) + " wide, expected " + std::to_string(width);
+                return false;
+            }
+            grid.emplace_back(data + start, length);
+        }
+        start = next;
+    }
+    if (grid.empty()) {
+        error = "no rows";
+        return false;
+    }
+    return true;
+}
+
+CorpusSummary PreProcess::ExtractCorpus(const std::string& directory, int N, bool periodic, PatternTable& table, int symmetry, int threadCount)
+{
+    std::vector<std::string> filenames;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (entry.is_regular_file()) {
+            filenames.push_back(entry.path().string());
+        }
+    }
+    std::sort(filenames.begin(), filenames.end());
+    const int fileCount = static_cast<int>(filenames.size());
+
+    std::vector<std::shared_ptr<const MappedFile>> files(fileCount);
+    std::vector<size_t> sizeBefore(fileCount + 1, 0); // bytes in files before this one, to balance the runs
+    for (int i = 0; i < fileCount; ++i) {
+        files[i] = MappedFile::Open(filenames[i]);
+        sizeBefore[i + 1] = sizeBefore[i] + (files[i] ? files[i]->Size() : 0);
+    }
+
+    if (threadCount <= 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::max(1, std::min(threadCount, fileCount));
+    std::vector<PatternTable> tables(threadCount);
+    std::vector<std::string> errors(fileCount);
+    auto extract = [&](int run) {
+        // Files whose first byte falls in this run's share of the corpus
+        size_t begin = sizeBefore[fileCount] * run / threadCount;
+        size_t end = sizeBefore[fileCount] * (run + 1) / threadCount;
+        tables[run].N = N;
+        std::vector<std::string> grid;
+        for (int i = 0; i < fileCount; ++i) {
+            bool inRun = sizeBefore[i] >= begin && (sizeBefore[i] < end || (run == threadCount - 1 && sizeBefore[i] == end));
+            if (!inRun) continue;
+            if (!files[i]) {
+                errors[i] = "could not be opened";
+            }
+            else if (ParseLevel(files[i]->Data(), files[i]->Size(), grid, errors[i])) {
+                ExtractPatterns(grid, N, periodic, tables[run], symmetry);
+            }
+        }
+    };
+
+    if (threadCount == 1) {
+        extract(0);
+    }
+    else {
+        std::vector<std::thread> threads;
+        for (int run = 0; run < threadCount; ++run) {
+            threads.emplace_back(extract, run);
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    if (table.N == 0) {
+        table.N = N;
+    }
+    if (table.N != N) {
+        throw std::runtime_error("Pattern size " + std::to_string(N) + " doesn't match the table's " + std::to_string(table.N));
+    }
+    for (const PatternTable& runTable : tables) {
+        for (int pattern = 0; pattern < runTable.PatternCount(); ++pattern) {
+            table.frequencies[table.Insert(runTable.hashes[pattern], runTable.Pattern(pattern))] += runTable.frequencies[pattern];
+        }
+    }
+
+    CorpusSummary summary;
+    for (int i = 0; i < fileCount; ++i) {
+        if (errors[i].empty()) {
+            summary.levels.push_back(filenames[i]);
+        }
+        else {
+            summary.rejected.push_back({ filenames[i], errors[i] });
+        }
+    }
+    return summary;
+}
+
+void PreProcess::ExtractPatterns(const std::vector<std::string>& grid, int N, bool periodic, PatternTable& table, int symmetry)
+{
+
+    if (table.N == 0) {
+        table.N = N;
+    }
+    if (table.N != N) {
+        throw std::runtime_error("Pattern size " + std::to_string(N) + " doesn't match the table's " + std::to_string(table.N));
+    }
+
+    if (symmetry > 1) {
+        // Count the windows once, then add every distinct window's transforms with its count.
+        // transforms[2k] is the window turned k quarters clockwise, transforms[2k + 1] its mirror.
+        PatternTable windows;
+        ExtractPatterns(grid, N, periodic, windows);
+        std::vector<std::vector<char>> transforms(8, std::vector<char>(N * N));
+        for (int pattern = 0; pattern < windows.PatternCount(); ++pattern) {
+            transforms[0].assign(windows.Pattern(pattern), windows.Pattern(pattern) + N * N);
+            for (int t = 0; t < std::min(symmetry, 8); ++t) {
+                std::vector<char>& transform = transforms[t];
+                if (t % 2 == 1) {
+                    const std::vector<char>& source = transforms[t - 1];
+                    for (int y = 0; y < N; ++y) {
+                        for (int x = 0; x < N; ++x) {
+                            transform[y * N + x] = source[y * N + N - 1 - x];
+                        }
+                    }
+                }
+                else if (t > 0) {
+                    const std::vector<char>& source = transforms[t - 2];
+                    for (int y = 0; y < N; ++y) {
+                        for (int x = 0; x < N; ++x) {
+                            transform[y * N + x] = source[(N - 1 - x) * N + y];
+                        }
+                    }
+                }
+                table.frequencies[table.Insert(PatternHash(transform.data(), N), transform.data())] += windows.frequencies[pattern];
+            }
+        }
+        return;
+    }
+
+    if (grid.empty()) return;
+
+    const int width = static_cast<int>(grid[0].size());
+    const int height = static_cast<int>(grid.size());
+    for (const std::string& row : grid) {
+        if (static_cast<int>(row.size()) != width) {
+            throw std::runtime_error("Level rows have different lengths");
+        }
+    }
+    // Window origins; a periodic level has one at every cell
+    const int windowsX = periodic ? width : width - N + 1;
+    const int windowsY = periodic ? height : height - N + 1;
+    if (windowsX <= 0 || windowsY <= 0) return;
+
+    uint64_t rowPow[2], columnPow[2];
+    for (int m = 0; m < 2; ++m) {
+        rowPow[m] = PowMod(ROW_BASE[m], N - 1, HASH_MOD[m]);
+        columnPow[m] = PowMod(COLUMN_BASE[m], N - 1, HASH_MOD[m]);
+    }
+
+    // Pass 1: hash of the N chars starting at every window origin of every row, rolled along x
+    std::vector<uint64_t> rowHashes(static_cast<size_t>(height) * windowsX * 2);
+    for (int y = 0; y < height; ++y) {
+        const std::string& row = grid[y];
+        for (int m = 0; m < 2; ++m) {
+            const uint64_t mod = HASH_MOD[m];
+            uint64_t hash = 0;
+            for (int dx = 0; dx < N; ++dx) {
+                hash = (hash * ROW_BASE[m] + static_cast<unsigned char>(row[dx % width])) % mod;
+            }
+            for (int x = 0; x < windowsX; ++x) {
+                rowHashes[(static_cast<size_t>(y) * windowsX + x) * 2 + m] = hash;
+                uint64_t out = static_cast<unsigned char>(row[x]) * rowPow[m] % mod;
+                uint64_t in = static_cast<unsigned char>(row[(x + N) % width]);
+                hash = ((hash + mod - out) * ROW_BASE[m] + in) % mod;
+            }
+        }
+    }
+
+    // Pass 2: combine N row hashes down every column, rolled along y, and count each window
+    for (int x = 0; x < windowsX; ++x) {
+        uint64_t hash[2] = { 0, 0 };
+        for (int m = 0; m < 2; ++m) {
+            for (int dy = 0; dy < N; ++dy) {
+                hash[m] = (hash[m] * COLUMN_BASE[m] + rowHashes[(static_cast<size_t>(dy % height) * windowsX + x) * 2 + m]) % HASH_MOD[m];
+            }
+        }
+        for (int y = 0; y < windowsY; ++y) {
+            uint64_t key = (hash[0] << 32) | hash[1];
+            table.frequencies[table.Insert(key, grid, x, y)]++;
+
+            for (int m = 0; m < 2; ++m) {
+                const uint64_t mod = HASH_MOD[m];
+                uint64_t out = rowHashes[(static_cast<size_t>(y) * windowsX + x) * 2 + m] * columnPow[m] % mod;
+                uint64_t in = rowHashes[(static_cast<size_t>((y + N) % height) * windowsX + x) * 2 + m];
+                hash[m] = ((hash[m] + mod - out) * COLUMN_BASE[m] + in) % mod;
+            }
+        }
+    }
+}
+
+// Edge strips of a pattern: all rows but the last (TOP) or first (BOTTOM), all columns but the
+// last (LEFT) or first (RIGHT). Pattern B fits in direction d of A when A's strip on side d
+// equals B's strip on the opposite side, indexed by Direction so OPPOSITE_SIDE is (d + 2) % 4.
+enum StripSide { TOP = 0, RIGHT = 1, BOTTOM = 2, LEFT = 3 };
+
+static char StripChar(const char* pattern, int N, int side, int i) {
+    // i walks the strip row-major, (N - 1) * N chars for TOP/BOTTOM and N * (N - 1) for LEFT/RIGHT
+    int stripWidth = (side == TOP || side == BOTTOM) ? N : N - 1;
+    int row = i / stripWidth + (side == BOTTOM ? 1 : 0);
+    int column = i % stripWidth + (side == RIGHT ? 1 : 0);
+    return pattern[row * N + column];
+}
+
+static uint64_t StripHash(const char* pattern, int N, int side) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (int i = 0; i < (N - 1) * N; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(StripChar(pattern, N, side, i))) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool StripsEqual(const char* a, int sideA, const char* b, int sideB, int N) {
+    for (int i = 0; i < (N - 1) * N; ++i) {
+        if (StripChar(a, N, sideA, i) != StripChar(b, N, sideB, i)) return false;
+    }
+    return true;
+}
+
+AdjacencyRules PreProcess::BuildOverlapRules(const PatternTable& table, int threadCount)
+{
+    const int N = table.N;
+    const int patternCount = table.PatternCount();
+
+    // One sorted (strip hash, pattern) index per side
+    std::vector<uint64_t> stripHashes(static_cast<size_t>(patternCount) * 4);
+    std::vector<std::pair<uint64_t, int>> index[4];
+    for (int side = 0; side < 4; ++side) {
+        index[side].reserve(patternCount);
+        for (int pattern = 0; pattern < patternCount; ++pattern) {
+            uint64_t hash = StripHash(table.Pattern(pattern), N, side);
+            stripHashes[pattern * 4 + side] = hash;
+            index[side].push_back({ hash, pattern });
+        }
+        std::sort(index[side].begin(), index[side].end());
+    }
+
+    // Join every pattern's strips against the opposite side's index, patterns split across threads
+    std::vector<std::vector<int>> compatible(static_cast<size_t>(patternCount) * 4);
+    auto join = [&](int begin, int end) {
+        for (int pattern = begin; pattern < end; ++pattern) {
+            for (int dir = 0; dir < 4; ++dir) {
+                int opposite = (dir + 2) % 4;
+                uint64_t hash = stripHashes[pattern * 4 + dir];
+                auto match = std::lower_bound(index[opposite].begin(), index[opposite].end(), std::make_pair(hash, -1));
+                std::vector<int>& allowed = compatible[pattern * 4 + dir];
+                for (; match != index[opposite].end() && match->first == hash; ++match) {
+                    if (StripsEqual(table.Pattern(pattern), dir, table.Pattern(match->second), opposite, N)) {
+                        allowed.push_back(match->second);
+                    }
+                }
+            }
+        }
+    };
+
+    if (threadCount <= 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::min(threadCount, std::max(1, patternCount / 256));
+    if (threadCount == 1) {
+        join(0, patternCount);
+    }
+    else {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; ++t) {
+            threads.emplace_back(join, patternCount * t / threadCount, patternCount * (t + 1) / threadCount);
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    AdjacencyRules adjacencyRules;
+    for (int pattern = 0; pattern < patternCount; ++pattern) {
+        for (int dir = 0; dir < 4; ++dir) {
+            adjacencyRules[{ pattern, static_cast<Direction>(dir) }] = std::move(compatible[pattern * 4 + dir]);
+        }
+    }
+    return adjacencyRules;
+}
+
+std::shared_ptr<const RuleSet> PreProcess::CompileOverlapRules(const PatternTable& table, int threadCount)
+{
+    std::vector<double> weights(table.frequencies.begin(), table.frequencies.end());
+    return RuleSet::Compile(BuildOverlapRules(table, threadCount), table.PatternCount(), weights, table.N, table.patterns);
 }
 
 void PreProcess::preprocess()
 {
-	// read level from text file 
-    std::string filename = "levels/lvl_1-1.txt";
-	std::vector<std::string> grid = getGridFromFile(filename);
+	// every NxN pattern of the levels and how often it occurs
+	CorpusSummary summary = ExtractCorpus("levels", this->patternSize, this->periodic, this->patternTable, this->symmetry);
+	for (const auto& [filename, reason] : summary.rejected) {
+		std::cerr << "Skipping " << filename << ": " << reason << std::endl;
+	}
+	this->rules.store(CompileOverlapRules(this->patternTable));
+}
+
+void PreProcess::AddLevel(const std::vector<std::string>& grid)
+{
+    std::shared_ptr<const RuleSet> current = this->rules.load();
+    int oldCount = this->patternTable.PatternCount();
+    ExtractPatterns(grid, this->patternSize, this->periodic, this->patternTable, this->symmetry);
+
+    // Without a previous version every pattern is new to the rules
+    AdjacencyRules addedRules = IndexPatterns(current ? oldCount : 0);
+    std::vector<double> weights(this->patternTable.frequencies.begin(), this->patternTable.frequencies.end());
+    if (current) {
+        this->rules.store(RuleSet::Update(*current, this->patternTable.PatternCount(), weights, addedRules, this->patternTable.patterns));
+    }
+    else {
+        this->rules.store(RuleSet::Compile(addedRules, this->patternTable.PatternCount(), weights, this->patternTable.N, this->patternTable.patterns));
+    }
+}
+
+AdjacencyRules PreProcess::IndexPatterns(int firstNew)
+{
+    const PatternTable& table = this->patternTable;
+    const int N = table.N;
+    const int patternCount = table.PatternCount();
+
+    // Patterns whose pairs are already in the rules (preprocess joins them in bulk) only need indexing
+    for (int pattern = this->indexedPatterns; pattern < patternCount; ++pattern) {
+        for (int side = 0; side < 4; ++side) {
+            this->stripIndex[side][StripHash(table.Pattern(pattern), N, side)].push_back(pattern);
+        }
+    }
+    this->indexedPatterns = patternCount;
 
-	// for each tile/char, report all adjacencies and frequencies
+    AdjacencyRules addedRules;
+    for (int pattern = firstNew; pattern < patternCount; ++pattern) {
+        for (int dir = 0; dir < 4; ++dir) {
+            int opposite = (dir + 2) % 4;
+            auto bucket = this->stripIndex[opposite].find(StripHash(table.Pattern(pattern), N, dir));
+            if (bucket == this->stripIndex[opposite].end()) continue;
+            for (int other : bucket->second) {
+                if (!StripsEqual(table.Pattern(pattern), dir, table.Pattern(other), opposite, N)) continue;
+                addedRules[{ pattern, static_cast<Direction>(dir) }].push_back(other);
+                // Pairs between two new patterns are found from both ends
+                if (other < firstNew) {
+                    addedRules[{ other, static_cast<Direction>(opposite) }].push_back(pattern);
+                }
+            }
+        }
+    }
+    return addedRules;
 }
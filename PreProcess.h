@@ -1,8 +1,95 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "RuleSet.h"
 
+// Distinct NxN patterns seen in one or more levels, with how often each occurred. Patterns are
+// stored back to back in one buffer (pattern p is N*N chars, row-major, at p * N * N) and found
+// again through an open addressing index over their hashes.
+struct PatternTable {
+	int N = 0;
+	std::vector<char> patterns;
+	std::vector<uint64_t> hashes;
+	std::vector<int> frequencies;
+
+	int PatternCount() const { return static_cast<int>(this->frequencies.size()); }
+	const char* Pattern(int pattern) const { return &this->patterns[static_cast<size_t>(pattern) * this->N * this->N]; }
+	// Index of the pattern with these N*N chars (and their hash), -1 if there is none
+	int Find(uint64_t hash, const char* block) const;
+	// Index of the pattern read from grid at (x, y), wrapping around the grid edges, added as a
+	// new pattern if there is none yet. hash only narrows the search, the chars decide.
+	int Insert(uint64_t hash, const std::vector<std::string>& grid, int x, int y);
+	// Same, with the pattern's N*N chars read from block
+	int Insert(uint64_t hash, const char* block);
+
+private:
+	std::vector<int> slots; // pattern index per slot, -1 for empty
+	void Grow();
+	// Index of the pattern with this hash for which same(pattern) holds, or the index a new
+	// pattern gets (added = true) once the caller has appended its chars
+	template <typename Same>
+	int FindOrAdd(uint64_t hash, Same same, bool& added);
+};
+
+// Outcome of PreProcess::ExtractCorpus: files used as levels, and files skipped with the reason
+struct CorpusSummary {
+	std::vector<std::string> levels;
+	std::vector<std::pair<std::string, std::string>> rejected;
+};
 
 class PreProcess
 {
 public:
+	PatternTable patternTable;
+	// Extraction settings for preprocess and AddLevel
+	int patternSize = 3;
+	bool periodic = false;
+	int symmetry = 1;
+
+	// Count every level in levels/ and publish the ruleset compiled from them
 	void preprocess();
-};
\ No newline at end of file
+	// Count one more level into patternTable and publish a new ruleset version that includes it.
+	// Only the level's new patterns are matched against the edge strip index, and the previous
+	// version's masks are extended rather than rebuilt. One caller at a time.
+	void AddLevel(const std::vector<std::string>& grid);
+	// Latest published overlapping-model ruleset, nullptr before the first preprocess/AddLevel.
+	// Safe to call while another thread publishes; a solver keeps the version it holds until it
+	// picks up a newer one with WFC::SetRules.
+	std::shared_ptr<const RuleSet> Rules() const { return this->rules.load(); }
+	static std::vector<std::string> getGridFromFile(std::string filename);
+	// Split file contents into rows and check they form a level: a non-empty rectangle of
+	// printable, non-space characters. Blank lines are skipped like getGridFromFile does.
+	static bool ParseLevel(const char* data, size_t size, std::vector<std::string>& grid, std::string& error);
+	// ExtractPatterns over every level file in directory. Files are memory mapped and split into
+	// contiguous runs of about equal size, one per thread, each counted into its own table; the
+	// tables are then merged in file order, so pattern ids match a sequential pass over the sorted
+	// file names whatever the thread count. threadCount 0 uses every core.
+	static CorpusSummary ExtractCorpus(const std::string& directory, int N, bool periodic, PatternTable& table, int symmetry = 1, int threadCount = 0);
+	// Count every NxN window of grid into table, wrapping around the edges when periodic.
+	// Windows are hashed with a 2D rolling hash, so the pass is linear in the grid size.
+	// symmetry > 1 also counts each window under the first symmetry of the 8 rotations and
+	// reflections of the square (identity, mirror, quarter turn, its mirror, ...). Transformed
+	// patterns are hashed like windows, so ones equal to an existing pattern merge into it.
+	static void ExtractPatterns(const std::vector<std::string>& grid, int N, bool periodic, PatternTable& table, int symmetry = 1);
+	// The same hash ExtractPatterns gives a window holding block (N*N chars, row-major)
+	static uint64_t PatternHash(const char* block, int N);
+	// Pattern B is allowed in direction d of pattern A when the two agree where they overlap once
+	// B is shifted one cell in d. Patterns are bucketed by hashes of their N-1 wide edge strips and
+	// matched with a hash join instead of comparing every pair. threadCount 0 uses every core.
+	static AdjacencyRules BuildOverlapRules(const PatternTable& table, int threadCount = 0);
+	// Overlapping-model ruleset: one tile per pattern, weighted by how often it occurred
+	static std::shared_ptr<const RuleSet> CompileOverlapRules(const PatternTable& table, int threadCount = 0);
+
+private:
+	std::atomic<std::shared_ptr<const RuleSet>> rules;
+	// Edge strip hash -> patterns with that strip, per side, for patterns 0..indexedPatterns-1
+	std::unordered_map<uint64_t, std::vector<int>> stripIndex[4];
+	int indexedPatterns = 0;
+
+	// Add patterns firstNew.. to the strip index and return every pair involving one of them
+	AdjacencyRules IndexPatterns(int firstNew);
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+
+// PCG32 (XSH RR variant, pcg-random.org). Small, fast and fully determined by (seed, stream):
+// generators with the same seed but different streams produce independent sequences, so
+// parallel solvers can each take their own stream and still be reproducible.
+class Random {
+public:
+	Random(uint64_t seed = 1, uint64_t stream = 0) {
+		Seed(seed, stream);
+	}
+
+	void Seed(uint64_t seed, uint64_t stream = 0) {
+		this->seed = seed;
+		this->stream = stream;
+		this->state = 0;
+		this->increment = (stream << 1) | 1;
+		NextUInt();
+		this->state += seed;
+		NextUInt();
+	}
+
+	// What the generator was last seeded with
+	uint64_t InitialSeed() const { return this->seed; }
+	uint64_t Stream() const { return this->stream; }
+
+	uint32_t NextUInt() {
+		uint64_t old = this->state;
+		this->state = old * 6364136223846793005ULL + this->increment;
+		uint32_t xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+		uint32_t rotation = static_cast<uint32_t>(old >> 59);
+		return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	}
+
+	// Uniform in [0, bound) without the modulo bias of rand() % n (Lemire's method)
+	uint32_t NextUInt(uint32_t bound) {
+		uint64_t product = static_cast<uint64_t>(NextUInt()) * bound;
+		uint32_t low = static_cast<uint32_t>(product);
+		if (low < bound) {
+			uint32_t threshold = (0u - bound) % bound;
+			while (low < threshold) {
+				product = static_cast<uint64_t>(NextUInt()) * bound;
+				low = static_cast<uint32_t>(product);
+			}
+		}
+		return static_cast<uint32_t>(product >> 32);
+	}
+
+	// Uniform in [0, 1)
+	double NextDouble() {
+		// Two statements so the draws happen in the same order on every compiler
+		uint64_t high = NextUInt();
+		uint64_t low = NextUInt();
+		uint64_t bits = (high << 21) ^ low;
+		return static_cast<double>(bits & ((1ULL << 53) - 1)) * (1.0 / (1ULL << 53));
+	}
+
+	float NextFloat() {
+		return static_cast<float>(NextUInt() >> 8) * (1.0f / (1u << 24));
+	}
+
+private:
+	uint64_t seed;
+	uint64_t stream;
+	uint64_t state;
+	uint64_t increment;
+};
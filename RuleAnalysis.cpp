@@ -0,0 +1,116 @@
+#include "RuleAnalysis.h"
+#include <algorithm>
+#include <tuple>
+
+static int Opposite(int dir) {
+	return (dir + 2) % 4;
+}
+
+RuleAnalysis RuleAnalysis::Analyze(const AdjacencyRules& adjacencyRules, int tileCount)
+{
+	RuleAnalysis analysis;
+
+	// Allowed neighbours per [tile][direction] as sorted lists so pairs can be looked up both ways
+	std::vector<std::vector<int>> allowed(static_cast<size_t>(tileCount) * 4);
+	for (const auto& [key, tiles] : adjacencyRules) {
+		std::vector<int>& list = allowed[key.first * 4 + static_cast<int>(key.second)];
+		list.insert(list.end(), tiles.begin(), tiles.end());
+	}
+	for (std::vector<int>& list : allowed) {
+		std::sort(list.begin(), list.end());
+		list.erase(std::unique(list.begin(), list.end()), list.end());
+	}
+
+	// Keep only the pairs allowed from both sides
+	std::vector<std::vector<int>> symmetric(allowed.size());
+	for (int tile = 0; tile < tileCount; ++tile) {
+		for (int dir = 0; dir < 4; ++dir) {
+			for (int neighbor : allowed[tile * 4 + dir]) {
+				const std::vector<int>& back = allowed[neighbor * 4 + Opposite(dir)];
+				if (std::binary_search(back.begin(), back.end(), tile)) {
+					symmetric[tile * 4 + dir].push_back(neighbor);
+				}
+				else {
+					analysis.asymmetricPairs.push_back({ tile, static_cast<Direction>(dir), neighbor });
+				}
+			}
+		}
+	}
+
+	// Remove tiles left without a neighbour on some side until none are; each removal takes a
+	// supporting neighbour away from the tiles it allowed
+	std::vector<int> supportCounts(allowed.size());
+	std::vector<bool> deadEnd(tileCount, false);
+	std::vector<int> toRemove;
+	for (int tile = 0; tile < tileCount; ++tile) {
+		for (int dir = 0; dir < 4; ++dir) {
+			supportCounts[tile * 4 + dir] = static_cast<int>(symmetric[tile * 4 + dir].size());
+			if (supportCounts[tile * 4 + dir] == 0 && !deadEnd[tile]) {
+				deadEnd[tile] = true;
+				toRemove.push_back(tile);
+			}
+		}
+	}
+	while (!toRemove.empty()) {
+		int tile = toRemove.back();
+		toRemove.pop_back();
+		analysis.deadEndTiles.push_back(tile);
+		for (int dir = 0; dir < 4; ++dir) {
+			for (int neighbor : symmetric[tile * 4 + dir]) {
+				if (--supportCounts[neighbor * 4 + Opposite(dir)] == 0 && !deadEnd[neighbor]) {
+					deadEnd[neighbor] = true;
+					toRemove.push_back(neighbor);
+				}
+			}
+		}
+	}
+	std::sort(analysis.deadEndTiles.begin(), analysis.deadEndTiles.end());
+
+	for (int tile = 0; tile < tileCount; ++tile) {
+		for (int dir = 0; dir < 4; ++dir) {
+			for (int neighbor : symmetric[tile * 4 + dir]) {
+				if (deadEnd[tile] || deadEnd[neighbor]) {
+					analysis.deadRules.push_back({ tile, static_cast<Direction>(dir), neighbor });
+				}
+			}
+		}
+	}
+	return analysis;
+}
+
+AdjacencyRules RuleAnalysis::Fix(const AdjacencyRules& adjacencyRules) const
+{
+	auto sameKey = [](const Pair& a, const Pair& b) {
+		return std::tie(a.tile, a.dir, a.neighbor) < std::tie(b.tile, b.dir, b.neighbor);
+	};
+	std::vector<Pair> removed = this->asymmetricPairs;
+	std::sort(removed.begin(), removed.end(), sameKey);
+
+	AdjacencyRules fixed;
+	for (const auto& [key, tiles] : adjacencyRules) {
+		std::vector<int>& kept = fixed[key];
+		for (int neighbor : tiles) {
+			if (!std::binary_search(removed.begin(), removed.end(), Pair{ key.first, key.second, neighbor }, sameKey)) {
+				kept.push_back(neighbor);
+			}
+		}
+	}
+	return fixed;
+}
+
+void RuleAnalysis::Print(std::ostream& out, const std::vector<std::string>& names) const
+{
+	static const char* DIRECTION_NAMES[4] = { "north", "east", "south", "west" };
+	auto name = [&](int tile) { return tile < static_cast<int>(names.size()) ? names[tile] : std::to_string(tile); };
+
+	for (const Pair& pair : this->asymmetricPairs) {
+		out << "asymmetric: " << name(pair.tile) << " allows " << name(pair.neighbor) << " to the " << DIRECTION_NAMES[static_cast<int>(pair.dir)]
+			<< " but " << name(pair.neighbor) << " doesn't allow it to the " << DIRECTION_NAMES[Opposite(static_cast<int>(pair.dir))] << std::endl;
+	}
+	for (int tile : this->deadEndTiles) {
+		out << "dead end: " << name(tile) << " has no possible neighbour on some side, it can only be placed on that border" << std::endl;
+	}
+	for (const Pair& pair : this->deadRules) {
+		out << "dead rule: " << name(pair.tile) << " " << DIRECTION_NAMES[static_cast<int>(pair.dir)] << " " << name(pair.neighbor) << std::endl;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+#include "RuleSet.h"
+
+// Consistency check of adjacency rules before they are compiled.
+//
+// An asymmetric pair is a tile allowing a neighbour that does not allow it back. Propagation
+// already bans such pairs from whichever side runs first, so Fix drops them and the rules mean
+// the same whatever order cells are visited in. A dead-end tile has no possible neighbour on
+// some side once asymmetric pairs and other dead-end tiles are gone. On a clamped grid it can
+// still sit on the border of that side. On a periodic grid every cell has all four neighbours,
+// so it can never be placed, but propagation already bans it there for lack of support. Either
+// way it is only reported and its rules are kept.
+class RuleAnalysis {
+public:
+	struct Pair {
+		int tile;
+		Direction dir;
+		int neighbor;
+	};
+
+	std::vector<Pair> asymmetricPairs;
+	std::vector<int> deadEndTiles;
+	std::vector<Pair> deadRules; // pairs that are symmetric but involve a dead-end tile, never used on periodic grids
+
+	static RuleAnalysis Analyze(const AdjacencyRules& adjacencyRules, int tileCount);
+
+	bool Clean() const { return this->asymmetricPairs.empty() && this->deadEndTiles.empty(); }
+	// The rules without asymmetric pairs
+	AdjacencyRules Fix(const AdjacencyRules& adjacencyRules) const;
+	// One line per finding, tiles by name when names are given
+	void Print(std::ostream& out, const std::vector<std::string>& names = {}) const;
+};
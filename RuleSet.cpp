@@ -0,0 +1,365 @@
+#include "RuleSet.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include "MappedFile.h"
+
+// Backing arrays of a RuleSet built in memory
+struct RuleSet::Tables {
+	std::vector<double> weights;
+	std::vector<double> weightLogWeights;
+	std::vector<char> patterns;
+	std::vector<TileMask> compatible;
+	std::vector<uint16_t> maskTable;
+	std::vector<int> compatibleTiles;
+	std::vector<int> compatibleOffsets;
+	std::vector<int> initialSupport;
+	std::vector<TileMask> allTiles;
+};
+
+namespace {
+	// Cache file layout, sections in the order of Section
+	enum Section { WEIGHTS, WEIGHT_LOG_WEIGHTS, PATTERNS, COMPATIBLE, MASK_TABLE, COMPATIBLE_TILES, COMPATIBLE_OFFSETS, INITIAL_SUPPORT, ALL_TILES, SECTION_COUNT };
+	constexpr uint32_t CACHE_MAGIC = 0x52434657; // "WFCR" read as a little-endian uint32
+
+	struct CacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t contentHash;
+		uint32_t tileMaskBytes; // sizeof(TileMask), rejects files written with another mask width
+		int32_t tileCount;
+		int32_t maskWords;
+		int32_t patternSize;
+		double initialSumWeights;
+		double initialSumWeightLogWeights;
+		float initialEntropy;
+		uint32_t reserved;
+		uint64_t rulesVersion; // RuleSet::version, so a cached Update keeps counting from where it was
+		uint64_t fileSize;
+		uint64_t sectionOffsets[SECTION_COUNT];
+		uint64_t sectionBytes[SECTION_COUNT];
+	};
+
+	uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+		// FNV-1a
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	template<typename T>
+	std::span<const char> SectionData(std::span<const T> table) {
+		return { reinterpret_cast<const char*>(table.data()), table.size_bytes() };
+	}
+
+	template<typename T>
+	std::span<const T> SectionView(const char* base, const CacheHeader& header, Section section) {
+		return { reinterpret_cast<const T*>(base + header.sectionOffsets[section]), header.sectionBytes[section] / sizeof(T) };
+	}
+}
+
+std::shared_ptr<const RuleSet> RuleSet::Compile(const AdjacencyRules& adjacencyRules, int tileCount, const std::vector<double>& weights,
+	int patternSize, std::span<const char> patterns)
+{
+	auto tables = std::make_shared<Tables>();
+	const int maskWords = MaskWords(tileCount);
+	tables->patterns.assign(patterns.begin(), patterns.end());
+	tables->compatible.assign(4 * tileCount * maskWords, 0);
+
+	tables->weights = weights.empty() ? std::vector<double>(tileCount, 1.0) : weights;
+	tables->weightLogWeights.resize(tileCount);
+	for (int tile = 0; tile < tileCount; ++tile) {
+		double weight = tables->weights[tile];
+		tables->weightLogWeights[tile] = weight > 0.0 ? weight * std::log(weight) : 0.0;
+	}
+
+	for (const auto& [key, allowed] : adjacencyRules) {
+		int tile = key.first;
+		int dir = static_cast<int>(key.second);
+		TileMask* mask = &tables->compatible[(dir * tileCount + tile) * maskWords];
+		for (int t : allowed) {
+			MaskSet(mask, t);
+		}
+	}
+
+	return Finish(std::move(tables), tileCount, patternSize, 0);
+}
+
+std::shared_ptr<const RuleSet> RuleSet::Update(const RuleSet& previous, int tileCount, const std::vector<double>& weights,
+	const AdjacencyRules& addedRules, std::span<const char> patterns)
+{
+	auto tables = std::make_shared<Tables>();
+	const int maskWords = MaskWords(tileCount);
+	tables->patterns.assign(patterns.begin(), patterns.end());
+
+	// Previous masks moved into the wider layout, then the new pairs on top
+	tables->compatible.assign(4 * tileCount * maskWords, 0);
+	for (int dir = 0; dir < 4; ++dir) {
+		for (int tile = 0; tile < previous.tileCount; ++tile) {
+			const TileMask* mask = previous.Compatible(tile, dir);
+			std::copy(mask, mask + previous.maskWords, &tables->compatible[(dir * tileCount + tile) * maskWords]);
+		}
+	}
+	for (const auto& [key, allowed] : addedRules) {
+		TileMask* mask = &tables->compatible[(static_cast<int>(key.second) * tileCount + key.first) * maskWords];
+		for (int t : allowed) {
+			MaskSet(mask, t);
+		}
+	}
+
+	// Only tiles that are new or changed weight need their w * log(w) again
+	tables->weights = weights.empty() ? std::vector<double>(tileCount, 1.0) : weights;
+	tables->weightLogWeights.resize(tileCount);
+	for (int tile = 0; tile < tileCount; ++tile) {
+		double weight = tables->weights[tile];
+		if (tile < previous.tileCount && previous.weights[tile] == weight) {
+			tables->weightLogWeights[tile] = previous.weightLogWeights[tile];
+		}
+		else {
+			tables->weightLogWeights[tile] = weight > 0.0 ? weight * std::log(weight) : 0.0;
+		}
+	}
+
+	return Finish(std::move(tables), tileCount, previous.patternSize, previous.version + 1);
+}
+
+std::shared_ptr<const RuleSet> RuleSet::Finish(std::shared_ptr<Tables> tables, int tileCount, int patternSize, uint64_t version)
+{
+	auto ruleSet = std::make_shared<RuleSet>();
+	ruleSet->tileCount = tileCount;
+	ruleSet->maskWords = MaskWords(tileCount);
+	ruleSet->patternSize = patternSize;
+	ruleSet->version = version;
+
+	tables->allTiles.assign(ruleSet->maskWords, 0);
+	for (int tile = 0; tile < tileCount; ++tile) {
+		MaskSet(tables->allTiles.data(), tile);
+	}
+
+	ruleSet->initialSumWeights = 0.0;
+	ruleSet->initialSumWeightLogWeights = 0.0;
+	for (int tile = 0; tile < tileCount; ++tile) {
+		ruleSet->initialSumWeights += tables->weights[tile];
+		ruleSet->initialSumWeightLogWeights += tables->weightLogWeights[tile];
+	}
+	ruleSet->initialEntropy = ShannonEntropy(ruleSet->initialSumWeights, ruleSet->initialSumWeightLogWeights);
+
+	// Flatten the masks into tile lists and count how many tiles support each (tile, direction)
+	tables->initialSupport.assign(tileCount * 4, 0);
+	tables->compatibleOffsets.reserve(4 * tileCount + 1);
+	for (int dir = 0; dir < 4; ++dir) {
+		for (int tile = 0; tile < tileCount; ++tile) {
+			tables->compatibleOffsets.push_back(static_cast<int>(tables->compatibleTiles.size()));
+			const TileMask* mask = &tables->compatible[(dir * tileCount + tile) * ruleSet->maskWords];
+			for (int word = 0; word < ruleSet->maskWords; ++word) {
+				for (TileMask remaining = mask[word]; remaining != 0; remaining &= remaining - 1) {
+					int t = word * TILE_MASK_BITS + std::countr_zero(remaining);
+					tables->compatibleTiles.push_back(t);
+					tables->initialSupport[t * 4 + dir]++;
+				}
+			}
+		}
+	}
+	tables->compatibleOffsets.push_back(static_cast<int>(tables->compatibleTiles.size()));
+
+	if (tileCount <= MASK_TABLE_MAX_TILES) {
+		// Each entry is the entry without its lowest tile plus that tile's own mask
+		const size_t domainCount = size_t(1) << tileCount;
+		tables->maskTable.assign(4 * domainCount, 0);
+		for (int dir = 0; dir < 4; ++dir) {
+			uint16_t* table = &tables->maskTable[dir * domainCount];
+			for (size_t domain = 1; domain < domainCount; ++domain) {
+				int lowest = std::countr_zero(domain);
+				table[domain] = table[domain & (domain - 1)] | static_cast<uint16_t>(tables->compatible[dir * tileCount + lowest]);
+			}
+		}
+	}
+
+	ruleSet->weights = tables->weights;
+	ruleSet->weightLogWeights = tables->weightLogWeights;
+	ruleSet->patterns = tables->patterns;
+	ruleSet->compatible = tables->compatible;
+	ruleSet->maskTable = tables->maskTable;
+	ruleSet->compatibleTiles = tables->compatibleTiles;
+	ruleSet->compatibleOffsets = tables->compatibleOffsets;
+	ruleSet->initialSupport = tables->initialSupport;
+	ruleSet->allTiles = tables->allTiles;
+	ruleSet->storage = std::move(tables);
+	return ruleSet;
+}
+
+std::shared_ptr<const RuleSet> RuleSet::TrackRules()
+{
+	static const std::shared_ptr<const RuleSet> trackRules = [] {
+		AdjacencyRules adjacencyRules;
+		for (int tile = 0; tile < TRACK_TILE_COUNT; ++tile) {
+			for (int dir = 0; dir < 4; ++dir) {
+				std::vector<int>& allowed = adjacencyRules[{ tile, static_cast<Direction>(dir) }];
+				for (int t = 0; t < TRACK_TILE_COUNT; ++t) {
+					if (TRACK_RULES[tile][dir] & TileBit(t)) {
+						allowed.push_back(t);
+					}
+				}
+			}
+		}
+		return Compile(adjacencyRules, TRACK_TILE_COUNT);
+	}();
+	return trackRules;
+}
+
+uint64_t RuleSet::ContentHash(const AdjacencyRules& adjacencyRules, int tileCount, const std::vector<double>& weights,
+	int patternSize, std::span<const char> patterns)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	hash = HashBytes(hash, &CACHE_VERSION, sizeof(CACHE_VERSION));
+	hash = HashBytes(hash, &tileCount, sizeof(tileCount));
+	for (const auto& [key, allowed] : adjacencyRules) {
+		int entry[3] = { key.first, static_cast<int>(key.second), static_cast<int>(allowed.size()) };
+		hash = HashBytes(hash, entry, sizeof(entry));
+		hash = HashBytes(hash, allowed.data(), allowed.size() * sizeof(int));
+	}
+	size_t weightCount = weights.size();
+	hash = HashBytes(hash, &weightCount, sizeof(weightCount));
+	hash = HashBytes(hash, weights.data(), weights.size() * sizeof(double));
+	hash = HashBytes(hash, &patternSize, sizeof(patternSize));
+	hash = HashBytes(hash, patterns.data(), patterns.size());
+	return hash;
+}
+
+bool RuleSet::Save(const std::string& filename, uint64_t contentHash) const
+{
+	std::span<const char> sections[SECTION_COUNT];
+	sections[WEIGHTS] = SectionData(this->weights);
+	sections[WEIGHT_LOG_WEIGHTS] = SectionData(this->weightLogWeights);
+	sections[PATTERNS] = SectionData(this->patterns);
+	sections[COMPATIBLE] = SectionData(this->compatible);
+	sections[MASK_TABLE] = SectionData(this->maskTable);
+	sections[COMPATIBLE_TILES] = SectionData(this->compatibleTiles);
+	sections[COMPATIBLE_OFFSETS] = SectionData(this->compatibleOffsets);
+	sections[INITIAL_SUPPORT] = SectionData(this->initialSupport);
+	sections[ALL_TILES] = SectionData(this->allTiles);
+
+	CacheHeader header{};
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.contentHash = contentHash;
+	header.tileMaskBytes = sizeof(TileMask);
+	header.tileCount = this->tileCount;
+	header.maskWords = this->maskWords;
+	header.patternSize = this->patternSize;
+	header.initialSumWeights = this->initialSumWeights;
+	header.initialSumWeightLogWeights = this->initialSumWeightLogWeights;
+	header.initialEntropy = this->initialEntropy;
+	header.rulesVersion = this->version;
+	uint64_t offset = sizeof(CacheHeader);
+	for (int section = 0; section < SECTION_COUNT; ++section) {
+		offset = (offset + 7) & ~uint64_t(7);
+		header.sectionOffsets[section] = offset;
+		header.sectionBytes[section] = sections[section].size();
+		offset += sections[section].size();
+	}
+	header.fileSize = offset;
+
+	// Write next to the target and rename over it, so concurrent readers only ever map a
+	// complete file
+	std::string tempFilename = filename + ".tmp" + std::to_string(std::random_device()());
+	{
+		std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+		if (!file) return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (int section = 0; section < SECTION_COUNT; ++section) {
+			static const char padding[8] = {};
+			file.write(padding, static_cast<std::streamsize>(header.sectionOffsets[section]) - file.tellp());
+			file.write(sections[section].data(), sections[section].size());
+		}
+		if (!file) {
+			file.close();
+			std::remove(tempFilename.c_str());
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(tempFilename, filename, error);
+	if (error) {
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::shared_ptr<const RuleSet> RuleSet::Load(const std::string& filename, uint64_t contentHash)
+{
+	std::shared_ptr<const MappedFile> file = MappedFile::Open(filename);
+	if (file == nullptr || file->Size() < sizeof(CacheHeader)) return nullptr;
+
+	// The header and the table sizes it implies are checked, the table contents are used in place
+	const CacheHeader& header = *reinterpret_cast<const CacheHeader*>(file->Data());
+	if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.tileMaskBytes != sizeof(TileMask) ||
+		header.fileSize != file->Size() || (contentHash != 0 && header.contentHash != contentHash)) {
+		return nullptr;
+	}
+	for (int section = 0; section < SECTION_COUNT; ++section) {
+		if (header.sectionOffsets[section] % 8 != 0 || header.sectionOffsets[section] > header.fileSize ||
+			header.sectionBytes[section] > header.fileSize - header.sectionOffsets[section]) {
+			return nullptr;
+		}
+	}
+	if (header.tileCount <= 0 || header.maskWords != MaskWords(header.tileCount) || header.patternSize < 0) return nullptr;
+	const uint64_t tileCount = static_cast<uint64_t>(header.tileCount);
+	const uint64_t maskWords = static_cast<uint64_t>(header.maskWords);
+	const uint64_t patternCells = static_cast<uint64_t>(header.patternSize) * static_cast<uint64_t>(header.patternSize);
+	const uint64_t maskTableEntries = header.tileCount <= MASK_TABLE_MAX_TILES ? uint64_t(4) << header.tileCount : 0;
+	if (header.sectionBytes[WEIGHTS] != tileCount * sizeof(double) ||
+		header.sectionBytes[WEIGHT_LOG_WEIGHTS] != tileCount * sizeof(double) ||
+		header.sectionBytes[PATTERNS] != tileCount * patternCells ||
+		header.sectionBytes[COMPATIBLE] != 4 * tileCount * maskWords * sizeof(TileMask) ||
+		header.sectionBytes[MASK_TABLE] != maskTableEntries * sizeof(uint16_t) ||
+		header.sectionBytes[COMPATIBLE_OFFSETS] != (4 * tileCount + 1) * sizeof(int) ||
+		header.sectionBytes[INITIAL_SUPPORT] != 4 * tileCount * sizeof(int) ||
+		header.sectionBytes[ALL_TILES] != maskWords * sizeof(TileMask)) {
+		return nullptr;
+	}
+	// The tile lists are indexed through the offsets, so those have to stay inside them
+	std::span<const int> offsets = SectionView<int>(file->Data(), header, COMPATIBLE_OFFSETS);
+	if (offsets.front() != 0 || header.sectionBytes[COMPATIBLE_TILES] != static_cast<uint64_t>(offsets.back()) * sizeof(int) ||
+		!std::is_sorted(offsets.begin(), offsets.end())) {
+		return nullptr;
+	}
+
+	auto ruleSet = std::make_shared<RuleSet>();
+	ruleSet->tileCount = header.tileCount;
+	ruleSet->maskWords = header.maskWords;
+	ruleSet->patternSize = header.patternSize;
+	ruleSet->version = header.rulesVersion;
+	ruleSet->initialSumWeights = header.initialSumWeights;
+	ruleSet->initialSumWeightLogWeights = header.initialSumWeightLogWeights;
+	ruleSet->initialEntropy = header.initialEntropy;
+	ruleSet->weights = SectionView<double>(file->Data(), header, WEIGHTS);
+	ruleSet->weightLogWeights = SectionView<double>(file->Data(), header, WEIGHT_LOG_WEIGHTS);
+	ruleSet->patterns = SectionView<char>(file->Data(), header, PATTERNS);
+	ruleSet->compatible = SectionView<TileMask>(file->Data(), header, COMPATIBLE);
+	ruleSet->maskTable = SectionView<uint16_t>(file->Data(), header, MASK_TABLE);
+	ruleSet->compatibleTiles = SectionView<int>(file->Data(), header, COMPATIBLE_TILES);
+	ruleSet->compatibleOffsets = SectionView<int>(file->Data(), header, COMPATIBLE_OFFSETS);
+	ruleSet->initialSupport = SectionView<int>(file->Data(), header, INITIAL_SUPPORT);
+	ruleSet->allTiles = SectionView<TileMask>(file->Data(), header, ALL_TILES);
+	ruleSet->storage = std::move(file);
+	return ruleSet;
+}
+
+std::shared_ptr<const RuleSet> RuleSet::CompileCached(const std::string& filename, const AdjacencyRules& adjacencyRules, int tileCount,
+	const std::vector<double>& weights, int patternSize, std::span<const char> patterns)
+{
+	uint64_t contentHash = ContentHash(adjacencyRules, tileCount, weights, patternSize, patterns);
+	if (std::shared_ptr<const RuleSet> cached = Load(filename, contentHash)) {
+		return cached;
+	}
+	std::shared_ptr<const RuleSet> ruleSet = Compile(adjacencyRules, tileCount, weights, patternSize, patterns);
+	ruleSet->Save(filename, contentHash); // the cache is best effort, a failed write just means compiling next time too
+	return ruleSet;
+}
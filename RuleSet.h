@@ -0,0 +1,90 @@
+#pragma once
+#include <map>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include "WFCUtility.h"
+
+// (tile id, direction) -> ids of the tiles allowed in that direction
+typedef std::map<std::pair<int, Direction>, std::vector<int>> AdjacencyRules;
+
+// Adjacency rules compiled into dense per-direction compatibility masks indexed by tile id.
+// Immutable once built, so any number of WFC instances can share one through a shared_ptr.
+// The tables are views into storage the RuleSet keeps alive, either its own compiled arrays or
+// a memory-mapped cache file written by Save.
+class RuleSet {
+public:
+	int tileCount;
+	int maskWords; // TileMask words per domain
+	std::span<const double> weights; // relative frequency of each tile, 1 for every tile by default
+	std::span<const double> weightLogWeights; // weights[t] * log(weights[t])
+	double initialSumWeights;
+	double initialSumWeightLogWeights;
+	float initialEntropy; // Shannon entropy of a cell with every tile possible
+	// Overlapping-model rulesets carry the patternSize x patternSize pattern behind each tile,
+	// row-major at patterns[tile * patternSize * patternSize]. 0 and empty for simple tilesets.
+	int patternSize = 0;
+	std::span<const char> patterns;
+	uint64_t version = 0; // 0 when compiled from scratch, one more than the previous ruleset for each Update
+
+	static std::shared_ptr<const RuleSet> Compile(const AdjacencyRules& adjacencyRules, int tileCount, const std::vector<double>& weights = {},
+		int patternSize = 0, std::span<const char> patterns = {});
+	// previous plus the (tile, direction) pairs in addedRules, with tiles previous.tileCount..tileCount-1
+	// appended and the weights replaced. previous's masks are copied rather than rebuilt and only
+	// new or changed weights are recomputed. Rules can only be added, never removed.
+	static std::shared_ptr<const RuleSet> Update(const RuleSet& previous, int tileCount, const std::vector<double>& weights,
+		const AdjacencyRules& addedRules, std::span<const char> patterns = {});
+	// Built-in track tileset, compiled once on first use
+	static std::shared_ptr<const RuleSet> TrackRules();
+
+	// Compiled ruleset cache. The file is the header followed by every table, 8 byte aligned, in
+	// this build's native layout, so Load maps it and points the tables into the mapping without
+	// parsing. Load returns nullptr if the file is missing, from another format version or build,
+	// or was written for a different contentHash (0 accepts any hash).
+	static constexpr uint32_t CACHE_VERSION = 2;
+	static uint64_t ContentHash(const AdjacencyRules& adjacencyRules, int tileCount, const std::vector<double>& weights = {},
+		int patternSize = 0, std::span<const char> patterns = {});
+	bool Save(const std::string& filename, uint64_t contentHash) const;
+	static std::shared_ptr<const RuleSet> Load(const std::string& filename, uint64_t contentHash = 0);
+	// Load the cache for these inputs if it is current, otherwise Compile and rewrite it
+	static std::shared_ptr<const RuleSet> CompileCached(const std::string& filename, const AdjacencyRules& adjacencyRules, int tileCount,
+		const std::vector<double>& weights = {}, int patternSize = 0, std::span<const char> patterns = {});
+
+	// Tiles allowed in direction dir of a cell holding tile
+	const TileMask* Compatible(int tile, int dir) const {
+		return &this->compatible[(dir * this->tileCount + tile) * this->maskWords];
+	}
+	// Tilesets with at most MASK_TABLE_MAX_TILES tiles also get a [direction][domain mask] table of
+	// the union of Compatible over the domain, so propagating a whole domain is one load
+	static constexpr int MASK_TABLE_MAX_TILES = 16;
+	bool HasMaskTable() const { return !this->maskTable.empty(); }
+	TileMask AllowedNeighbors(TileMask domain, int dir) const {
+		return this->maskTable[(static_cast<size_t>(dir) << this->tileCount) + domain];
+	}
+	// Same as Compatible but as a list of tile ids, for the AC-4 propagator
+	std::span<const int> CompatibleList(int tile, int dir) const {
+		int entry = dir * this->tileCount + tile;
+		return this->compatibleTiles.subspan(this->compatibleOffsets[entry], this->compatibleOffsets[entry + 1] - this->compatibleOffsets[entry]);
+	}
+	// Initial AC-4 support counters of one cell, laid out [tile][direction]. Entry (t, d) is the
+	// number of tiles in the cell opposite d (the cell at -d) that allow t in direction d.
+	const int* InitialSupport() const { return this->initialSupport.data(); }
+	// Domain with every tile possible
+	const TileMask* AllTiles() const { return this->allTiles.data(); }
+
+private:
+	struct Tables;
+	// Derive everything else from tables->compatible, weights, weightLogWeights and patterns
+	static std::shared_ptr<const RuleSet> Finish(std::shared_ptr<Tables> tables, int tileCount, int patternSize, uint64_t version);
+
+	std::span<const TileMask> compatible; // [direction][tile][word]
+	std::span<const uint16_t> maskTable; // [direction][domain mask], 16 bit entries to stay cache resident
+	std::span<const int> compatibleTiles;
+	std::span<const int> compatibleOffsets; // [direction][tile] -> start in compatibleTiles, plus an end sentinel
+	std::span<const int> initialSupport; // [tile][direction]
+	std::span<const TileMask> allTiles;
+	std::shared_ptr<const void> storage; // owns the memory behind every span above
+};
@@ -0,0 +1,214 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "WFC.h"
+
+// Narrowest unsigned integer with a bit for each of NumTiles tiles
+template<int NumTiles>
+using SmallTileMask = std::conditional_t<NumTiles <= 8, uint8_t,
+	std::conditional_t<NumTiles <= 16, uint16_t,
+	std::conditional_t<NumTiles <= 32, uint32_t, uint64_t>>>;
+
+// Compile-time tileset for SmallWFC: the tile count and RULES[tile][direction] masks as constexpr members
+struct TrackTileset {
+	static constexpr int TILE_COUNT = TRACK_TILE_COUNT;
+	static constexpr const auto& RULES = TRACK_RULES;
+};
+
+// WFC specialised at compile time for one small tileset. Domains use the narrowest mask type,
+// the rule table is folded into constants, the four directions are unrolled and the next cell
+// comes from a bucket queue keyed by domain size. Tiles are equally likely and contradictions
+// restart; use WFC for runtime rulesets, weights, AC-4 or backtracking.
+template<typename Tileset>
+class SmallWFC {
+public:
+	static constexpr int TILE_COUNT = Tileset::TILE_COUNT;
+	static_assert(TILE_COUNT > 0 && TILE_COUNT <= 64, "SmallWFC handles 1 to 64 tiles, use WFC for larger tilesets");
+	using Mask = SmallTileMask<TILE_COUNT>;
+
+	int gridWidth;
+	int gridHeight;
+	std::vector<Mask> domains; // row-major, cell (x, y) at y * gridWidth + x
+	int maxRestarts = -1; // restarts a Solve call may make before giving up, -1 for no limit
+	Random random;
+
+	SmallWFC(int gridWidth, int gridHeight, uint64_t seed = 1)
+		: gridWidth(gridWidth), gridHeight(gridHeight), random(seed)
+	{
+		this->domains.resize(gridWidth * gridHeight);
+		this->collapsed.resize(gridWidth * gridHeight);
+		this->bucketSlots.resize(gridWidth * gridHeight);
+		for (auto& bucket : this->buckets) {
+			bucket.reserve(gridWidth * gridHeight);
+		}
+		this->toVisit.reserve(gridWidth * gridHeight);
+		Reset();
+	}
+
+	void Reset() {
+		std::fill(this->domains.begin(), this->domains.end(), ALL_TILES);
+		std::fill(this->collapsed.begin(), this->collapsed.end(), 0);
+		for (auto& bucket : this->buckets) {
+			bucket.clear();
+		}
+		for (int cell = 0; cell < this->gridWidth * this->gridHeight; ++cell) {
+			this->bucketSlots[cell] = cell;
+			this->buckets[TILE_COUNT].push_back(cell);
+		}
+	}
+
+	// Run until every cell is collapsed (or maxRestarts is hit)
+	WFCResult Solve() {
+		WFCResult result{ WFCStatus::RUNNING, 0, 0, 0 };
+		while (true) {
+			int count = 1;
+			while (count <= TILE_COUNT && this->buckets[count].empty()) {
+				++count;
+			}
+			if (count > TILE_COUNT) {
+				result.status = WFCStatus::SUCCESS;
+				return result;
+			}
+
+			result.steps++;
+			if (!Observe(count)) {
+				if (this->maxRestarts >= 0 && result.restarts >= this->maxRestarts) {
+					result.status = WFCStatus::CONTRADICTION;
+					return result;
+				}
+				Reset();
+				result.restarts++;
+			}
+		}
+	}
+
+	int TileAt(int x, int y) const {
+		return std::countr_zero(this->domains[y * this->gridWidth + x]);
+	}
+
+	void GetOutput(std::vector<std::vector<int>>& output) const {
+		output.resize(this->gridHeight);
+		for (int y = 0; y < this->gridHeight; ++y) {
+			output[y].resize(this->gridWidth);
+			for (int x = 0; x < this->gridWidth; ++x) {
+				output[y][x] = TileAt(x, y);
+			}
+		}
+	}
+
+private:
+	// Tileset::RULES narrowed to Mask and laid out [direction][tile]
+	static constexpr std::array<std::array<Mask, TILE_COUNT>, 4> COMPATIBLE = [] {
+		std::array<std::array<Mask, TILE_COUNT>, 4> compatible{};
+		for (int dir = 0; dir < 4; ++dir) {
+			for (int tile = 0; tile < TILE_COUNT; ++tile) {
+				compatible[dir][tile] = static_cast<Mask>(Tileset::RULES[tile][dir]);
+			}
+		}
+		return compatible;
+	}();
+	// Up to 8 tiles the union of COMPATIBLE over every possible domain fits a 256 entry table per
+	// direction, so propagating a cell is one load per direction
+	static constexpr bool USE_MASK_TABLE = TILE_COUNT <= 8;
+	static constexpr std::array<std::array<Mask, USE_MASK_TABLE ? (1 << TILE_COUNT) : 1>, 4> MASK_TABLE = [] {
+		std::array<std::array<Mask, USE_MASK_TABLE ? (1 << TILE_COUNT) : 1>, 4> table{};
+		if constexpr (USE_MASK_TABLE) {
+			for (int dir = 0; dir < 4; ++dir) {
+				for (int domain = 1; domain < (1 << TILE_COUNT); ++domain) {
+					table[dir][domain] = table[dir][domain & (domain - 1)] | COMPATIBLE[dir][std::countr_zero(static_cast<unsigned>(domain))];
+				}
+			}
+		}
+		return table;
+	}();
+	static constexpr Mask ALL_TILES = static_cast<Mask>(TILE_COUNT == 64 ? ~uint64_t(0) : (uint64_t(1) << TILE_COUNT) - 1);
+
+	std::vector<uint8_t> collapsed;
+	// Uncollapsed cells bucketed by domain size, bucketSlots[cell] is the cell's index in its bucket
+	std::array<std::vector<int>, TILE_COUNT + 1> buckets;
+	std::vector<int> bucketSlots;
+	std::vector<int> toVisit;
+
+	void RemoveFromBucket(int cell, int count) {
+		std::vector<int>& bucket = this->buckets[count];
+		int last = bucket.back();
+		bucket[this->bucketSlots[cell]] = last;
+		this->bucketSlots[last] = this->bucketSlots[cell];
+		bucket.pop_back();
+	}
+
+	bool Observe(int count) {
+		// Random cell among the smallest domains, then a random tile of that cell
+		std::vector<int>& bucket = this->buckets[count];
+		int cell = bucket[this->random.NextUInt(static_cast<uint32_t>(bucket.size()))];
+		RemoveFromBucket(cell, count);
+		this->collapsed[cell] = 1;
+
+		Mask domain = this->domains[cell];
+		for (uint32_t n = this->random.NextUInt(static_cast<uint32_t>(count)); n > 0; --n) {
+			domain &= domain - 1;
+		}
+		this->domains[cell] = domain & (~domain + 1);
+
+		return Propagate(cell);
+	}
+
+	// Narrow the neighbour in Dir of (x, y), false on contradiction
+	template<int Dir>
+	bool Narrow(int x, int y, Mask allowed) {
+		if constexpr (Dir == 0) { if (y == 0) return true; }
+		if constexpr (Dir == 1) { if (x == this->gridWidth - 1) return true; }
+		if constexpr (Dir == 2) { if (y == this->gridHeight - 1) return true; }
+		if constexpr (Dir == 3) { if (x == 0) return true; }
+
+		int neighbor = (y + DIRECTION_DY[Dir]) * this->gridWidth + x + DIRECTION_DX[Dir];
+		if (this->collapsed[neighbor]) return true;
+
+		Mask old = this->domains[neighbor];
+		Mask narrowed = old & allowed;
+		if (narrowed == old) return true;
+		if (narrowed == 0) return false;
+
+		this->domains[neighbor] = narrowed;
+		RemoveFromBucket(neighbor, std::popcount(old));
+		this->bucketSlots[neighbor] = static_cast<int>(this->buckets[std::popcount(narrowed)].size());
+		this->buckets[std::popcount(narrowed)].push_back(neighbor);
+		this->toVisit.push_back(neighbor);
+		return true;
+	}
+
+	bool Propagate(int start) {
+		this->toVisit.clear();
+		this->toVisit.push_back(start);
+		while (!this->toVisit.empty()) {
+			int cell = this->toVisit.back();
+			this->toVisit.pop_back();
+
+			std::array<Mask, 4> allowed{};
+			Mask domain = this->domains[cell];
+			if constexpr (USE_MASK_TABLE) {
+				allowed = { MASK_TABLE[0][domain], MASK_TABLE[1][domain], MASK_TABLE[2][domain], MASK_TABLE[3][domain] };
+			}
+			else {
+				for (Mask remaining = domain; remaining != 0; remaining &= remaining - 1) {
+					int tile = std::countr_zero(remaining);
+					allowed[0] |= COMPATIBLE[0][tile];
+					allowed[1] |= COMPATIBLE[1][tile];
+					allowed[2] |= COMPATIBLE[2][tile];
+					allowed[3] |= COMPATIBLE[3][tile];
+				}
+			}
+
+			int x = cell % this->gridWidth;
+			int y = cell / this->gridWidth;
+			if (!Narrow<0>(x, y, allowed[0]) || !Narrow<1>(x, y, allowed[1]) ||
+				!Narrow<2>(x, y, allowed[2]) || !Narrow<3>(x, y, allowed[3])) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,117 @@
+#include "TileClasses.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+TileClasses TileClasses::Merge(std::shared_ptr<const RuleSet> tiles)
+{
+	const RuleSet& rules = *tiles;
+	const int tileCount = rules.tileCount;
+
+	// usedBy[dir][tile]: tiles that allow tile in direction dir, in increasing order
+	std::vector<std::vector<int>> usedBy[4];
+	for (int dir = 0; dir < 4; ++dir) {
+		usedBy[dir].resize(tileCount);
+		for (int tile = 0; tile < tileCount; ++tile) {
+			for (int allowed : rules.CompatibleList(tile, dir)) {
+				usedBy[dir][allowed].push_back(tile);
+			}
+		}
+	}
+
+	// Hash each tile's masks and usedBy lists, then confirm candidates with the same hash exactly
+	auto signatureHash = [&](int tile) {
+		uint64_t hash = 14695981039346656037ULL;
+		auto add = [&](uint64_t value) { hash = (hash ^ value) * 1099511628211ULL; };
+		for (int dir = 0; dir < 4; ++dir) {
+			const TileMask* mask = rules.Compatible(tile, dir);
+			for (int word = 0; word < rules.maskWords; ++word) add(mask[word]);
+			add(usedBy[dir][tile].size());
+			for (int user : usedBy[dir][tile]) add(user);
+		}
+		return hash;
+	};
+	auto equivalent = [&](int a, int b) {
+		for (int dir = 0; dir < 4; ++dir) {
+			if (std::memcmp(rules.Compatible(a, dir), rules.Compatible(b, dir), rules.maskWords * sizeof(TileMask)) != 0) return false;
+			if (usedBy[dir][a] != usedBy[dir][b]) return false;
+		}
+		return true;
+	};
+
+	TileClasses classes;
+	classes.tiles = std::move(tiles);
+	classes.classOf.assign(tileCount, -1);
+	std::vector<int> representatives; // first tile of each class
+	std::unordered_map<uint64_t, std::vector<int>> classesByHash;
+	for (int tile = 0; tile < tileCount; ++tile) {
+		std::vector<int>& candidates = classesByHash[signatureHash(tile)];
+		for (int tileClass : candidates) {
+			if (equivalent(representatives[tileClass], tile)) {
+				classes.classOf[tile] = tileClass;
+				break;
+			}
+		}
+		if (classes.classOf[tile] < 0) {
+			classes.classOf[tile] = static_cast<int>(representatives.size());
+			candidates.push_back(classes.classOf[tile]);
+			representatives.push_back(tile);
+		}
+	}
+	const int classCount = static_cast<int>(representatives.size());
+
+	classes.memberOffsets.assign(classCount + 1, 0);
+	for (int tile = 0; tile < tileCount; ++tile) {
+		classes.memberOffsets[classes.classOf[tile] + 1]++;
+	}
+	for (int tileClass = 0; tileClass < classCount; ++tileClass) {
+		classes.memberOffsets[tileClass + 1] += classes.memberOffsets[tileClass];
+	}
+	classes.members.resize(tileCount);
+	std::vector<int> filled(classes.memberOffsets.begin(), classes.memberOffsets.end() - 1);
+	for (int tile = 0; tile < tileCount; ++tile) {
+		classes.members[filled[classes.classOf[tile]]++] = tile;
+	}
+
+	// A class allows whatever classes its representative's allowed tiles belong to
+	AdjacencyRules adjacencyRules;
+	std::vector<double> weights(classCount, 0.0);
+	for (int tile = 0; tile < tileCount; ++tile) {
+		weights[classes.classOf[tile]] += rules.weights[tile];
+	}
+	for (int tileClass = 0; tileClass < classCount; ++tileClass) {
+		for (int dir = 0; dir < 4; ++dir) {
+			std::vector<int>& allowed = adjacencyRules[{ tileClass, static_cast<Direction>(dir) }];
+			for (int tile : rules.CompatibleList(representatives[tileClass], dir)) {
+				allowed.push_back(classes.classOf[tile]);
+			}
+			std::sort(allowed.begin(), allowed.end());
+			allowed.erase(std::unique(allowed.begin(), allowed.end()), allowed.end());
+		}
+	}
+	classes.rules = RuleSet::Compile(adjacencyRules, classCount, weights);
+	return classes;
+}
+
+int TileClasses::PickTile(int tileClass, Random& random) const
+{
+	const int begin = this->memberOffsets[tileClass];
+	const int end = this->memberOffsets[tileClass + 1];
+	if (end - begin == 1) return this->members[begin];
+
+	double target = this->rules->weights[tileClass] * random.NextDouble();
+	for (int i = begin; i < end - 1; ++i) {
+		target -= this->tiles->weights[this->members[i]];
+		if (target < 0.0) return this->members[i];
+	}
+	return this->members[end - 1];
+}
+
+void TileClasses::Expand(std::vector<std::vector<int>>& output, Random& random) const
+{
+	for (std::vector<int>& row : output) {
+		for (int& cell : row) {
+			if (cell >= 0) cell = PickTile(cell, random);
+		}
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "Random.h"
+#include "RuleSet.h"
+
+// Interchangeable tiles merged into one solver tile per class. Two tiles are interchangeable when
+// they allow the same tiles in every direction and every tile allows both or neither, so any
+// member can stand in for any other. Solve with rules, whose tile ids are class ids weighted by
+// the sum of their members, then Expand the output to pick a concrete tile per cell.
+class TileClasses {
+public:
+	std::shared_ptr<const RuleSet> tiles; // the rules that were merged
+	std::shared_ptr<const RuleSet> rules; // one tile per class
+	std::vector<int> classOf; // tile -> class
+	std::vector<int> members; // tiles of class c at members[memberOffsets[c]..memberOffsets[c + 1]]
+	std::vector<int> memberOffsets;
+
+	static TileClasses Merge(std::shared_ptr<const RuleSet> tiles);
+
+	int ClassCount() const { return this->rules->tileCount; }
+	// Member of tileClass drawn by weight
+	int PickTile(int tileClass, Random& random) const;
+	// Replace the class ids in a solver's output with tiles, cells below 0 are left alone
+	void Expand(std::vector<std::vector<int>>& output, Random& random) const;
+};
@@ -0,0 +1,180 @@
+#include "TileSet.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+static Direction ParseDirection(const std::string& name, const std::string& filename, int lineNumber) {
+	if (name == "north") return Direction::NORTH;
+	if (name == "east") return Direction::EAST;
+	if (name == "south") return Direction::SOUTH;
+	if (name == "west") return Direction::WEST;
+	throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": unknown direction " + name);
+}
+
+// Symmetry classes: how many distinct orientations a tile has and which of them a clockwise quarter
+// turn or a left-right mirror maps each one to. Orientation 0 is the texture as drawn.
+struct SymmetryClass {
+	char name;
+	int cardinality;
+	int (*rotate)(int);
+	int (*reflect)(int);
+};
+
+static const SymmetryClass SYMMETRY_CLASSES[] = {
+	{ 'X', 1, [](int i) { return i; }, [](int i) { return i; } },
+	{ 'I', 2, [](int i) { return 1 - i; }, [](int i) { return i; } },
+	{ '\\', 2, [](int i) { return 1 - i; }, [](int i) { return 1 - i; } },
+	{ 'T', 4, [](int i) { return (i + 1) % 4; }, [](int i) { return i % 2 == 0 ? i : 4 - i; } },
+	{ 'L', 4, [](int i) { return (i + 1) % 4; }, [](int i) { return 3 - i; } },
+	{ 'F', 8, [](int i) { return i < 4 ? (i + 1) % 4 : 4 + (i + 3) % 4; }, [](int i) { return i < 4 ? i + 4 : i - 4; } },
+};
+
+static const SymmetryClass& ParseSymmetry(const std::string& name, const std::string& filename, int lineNumber) {
+	for (const SymmetryClass& symmetry : SYMMETRY_CLASSES) {
+		if (name.size() == 1 && name[0] == symmetry.name) return symmetry;
+	}
+	throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": unknown symmetry " + name);
+}
+
+int TileSet::Transform(int tile, bool reflect, int rotations) const
+{
+	if (reflect) tile = this->reflected[tile];
+	for (int i = 0; i < rotations; ++i) tile = this->rotated[tile];
+	return tile;
+}
+
+TileSet TileSet::Load(const std::string& filename)
+{
+	std::ifstream file(filename);
+	if (!file) {
+		throw std::runtime_error("Could not open file: " + filename);
+	}
+
+	TileSet tileSet;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		++lineNumber;
+		line = line.substr(0, line.find('#'));
+		std::istringstream words(line);
+		std::string keyword;
+		if (!(words >> keyword)) continue;
+
+		if (keyword == "tile") {
+			std::string name, texturePath, weightName, symmetryName, extra;
+			double weight = 1.0;
+			if (!(words >> name >> texturePath) || (words >> weightName >> symmetryName >> extra)) {
+				throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": expected tile <name> <texture> [weight [symmetry]]");
+			}
+			if (!weightName.empty()) {
+				// A zero or unparsed weight would skew the entropies, so only a positive number is accepted
+				size_t parsed = 0;
+				try {
+					weight = std::stod(weightName, &parsed);
+				}
+				catch (const std::exception&) {
+					parsed = 0;
+				}
+				if (parsed != weightName.size() || !(weight > 0.0) || !std::isfinite(weight)) {
+					throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": tile weight must be a positive number, got " + weightName);
+				}
+			}
+			if (tileSet.ids.count(name)) {
+				throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": duplicate tile " + name);
+			}
+
+			if (symmetryName.empty()) {
+				tileSet.ids[name] = tileSet.TileCount();
+				tileSet.names.push_back(name);
+				tileSet.texturePaths.push_back(texturePath);
+				tileSet.orientations.push_back({});
+				tileSet.weights.push_back(weight);
+				tileSet.rotated.push_back(-1);
+				tileSet.reflected.push_back(-1);
+				continue;
+			}
+
+			// One tile per distinct orientation. Turning orientation 0 (then its mirror image) a
+			// quarter at a time reaches every one, plain rotations first.
+			const SymmetryClass& symmetry = ParseSymmetry(symmetryName, filename, lineNumber);
+			const int first = tileSet.TileCount();
+			std::vector<TileOrientation> orientations(symmetry.cardinality);
+			std::vector<bool> reached(symmetry.cardinality, false);
+			for (int reflect = 0; reflect < 2; ++reflect) {
+				int variant = reflect ? symmetry.reflect(0) : 0;
+				for (int rotation = 0; rotation < 4; ++rotation) {
+					if (!reached[variant]) {
+						reached[variant] = true;
+						orientations[variant] = { rotation, reflect == 1 };
+					}
+					variant = symmetry.rotate(variant);
+				}
+			}
+			for (int variant = 0; variant < symmetry.cardinality; ++variant) {
+				std::string variantName = variant == 0 ? name : name + ":" + std::to_string(variant);
+				tileSet.ids[variantName] = tileSet.TileCount();
+				tileSet.names.push_back(variantName);
+				tileSet.texturePaths.push_back(texturePath);
+				tileSet.orientations.push_back(orientations[variant]);
+				tileSet.weights.push_back(weight);
+				tileSet.rotated.push_back(first + symmetry.rotate(variant));
+				tileSet.reflected.push_back(first + symmetry.reflect(variant));
+			}
+		}
+		else if (keyword == "rule") {
+			std::string name, directionName, allowedName;
+			if (!(words >> name >> directionName)) {
+				throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": expected rule <tile> <direction> <tiles...>");
+			}
+			int tile = tileSet.TileId(name);
+			if (tile < 0) {
+				throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": unknown tile " + name);
+			}
+			int dir = static_cast<int>(ParseDirection(directionName, filename, lineNumber));
+			std::vector<int> allowed;
+			bool symmetric = tileSet.rotated[tile] >= 0;
+			while (words >> allowedName) {
+				int allowedTile = tileSet.TileId(allowedName);
+				if (allowedTile < 0) {
+					throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": unknown tile " + allowedName);
+				}
+				allowed.push_back(allowedTile);
+				symmetric = symmetric && tileSet.rotated[allowedTile] >= 0;
+			}
+
+			// Every rotation and reflection of the rule, or just the rule if a tile has no symmetry class
+			for (int reflect = 0; reflect < (symmetric ? 2 : 1); ++reflect) {
+				for (int rotations = 0; rotations < (symmetric ? 4 : 1); ++rotations) {
+					int transformedDir = ((reflect ? (4 - dir) % 4 : dir) + rotations) % 4;
+					std::vector<int>& transformed = tileSet.adjacencyRules[{ tileSet.Transform(tile, reflect, rotations), static_cast<Direction>(transformedDir) }];
+					for (int allowedTile : allowed) {
+						transformed.push_back(tileSet.Transform(allowedTile, reflect, rotations));
+					}
+				}
+			}
+		}
+		else {
+			throw std::runtime_error(filename + ":" + std::to_string(lineNumber) + ": unknown entry " + keyword);
+		}
+	}
+
+	// Symmetric rules land on the same (tile, direction) more than once
+	for (auto& [key, allowed] : tileSet.adjacencyRules) {
+		std::sort(allowed.begin(), allowed.end());
+		allowed.erase(std::unique(allowed.begin(), allowed.end()), allowed.end());
+	}
+
+	tileSet.analysis = RuleAnalysis::Analyze(tileSet.adjacencyRules, tileSet.TileCount());
+	tileSet.adjacencyRules = tileSet.analysis.Fix(tileSet.adjacencyRules);
+
+	tileSet.rules = RuleSet::Compile(tileSet.adjacencyRules, tileSet.TileCount(), tileSet.weights);
+	return tileSet;
+}
+
+int TileSet::TileId(const std::string& name) const
+{
+	auto it = this->ids.find(name);
+	return it == this->ids.end() ? -1 : it->second;
+}
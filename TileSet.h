@@ -0,0 +1,51 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "RuleAnalysis.h"
+#include "RuleSet.h"
+
+// How a tile's texture is drawn: mirrored left to right if reflected, then turned rotation
+// quarter turns clockwise
+struct TileOrientation {
+	int rotation = 0;
+	bool reflected = false;
+};
+
+// A tileset loaded from a text file. Tile names are interned into dense ids 0..tileCount-1 in
+// the order they are declared, everything past loading (RuleSet, WFC) only sees those ids.
+//
+// File format, one entry per line, '#' starts a comment:
+//   tile <name> <texture path> [weight [symmetry]]
+//   rule <tile> <north|east|south|west> <allowed tile> [allowed tile ...]
+//
+// A symmetry class (X, I, \, T, L or F) generates the distinct rotations and reflections of the
+// tile as extra tiles named <name>:1, <name>:2, ... sharing its texture and weight; <name>:k for
+// k < 4 is the texture turned k quarters clockwise. The texture of a T tile must be unchanged by
+// a left-right mirror (stem up or down, like ┴) and an L tile must join north and east (└). A rule whose tiles all have a symmetry class is added in every rotation
+// and reflection, so a rotationally symmetric tileset only needs rules for one orientation.
+class TileSet {
+public:
+	std::vector<std::string> names;
+	std::vector<std::string> texturePaths;
+	std::vector<TileOrientation> orientations;
+	std::vector<double> weights;
+	AdjacencyRules adjacencyRules; // as written, with the asymmetric pairs analysis reports removed
+	RuleAnalysis analysis;
+	std::shared_ptr<const RuleSet> rules; // compiled from adjacencyRules and weights
+
+	static TileSet Load(const std::string& filename);
+
+	int TileCount() const { return static_cast<int>(this->names.size()); }
+	// Dense id of a tile name, -1 if there is no such tile
+	int TileId(const std::string& name) const;
+
+private:
+	std::unordered_map<std::string, int> ids;
+	// Tile turned a quarter clockwise / mirrored left to right, -1 for tiles without a symmetry class
+	std::vector<int> rotated;
+	std::vector<int> reflected;
+
+	int Transform(int tile, bool reflect, int rotations) const;
+};
@@ -1,254 +1,593 @@
 #include "WFC.h"
-#include <queue>
-#include <set>
+#include <limits>
+#include <algorithm>
 #include <stacktrace>
 
-WFC::WFC(const int gridWidth, const int gridHeight)
+WFC::WFC(const int gridWidth, const int gridHeight, std::shared_ptr<const RuleSet> rules, PropagationEngine engine, uint64_t seed)
 {
-	this->adjacencyRules[{ Tiles::BLANK, Direction::NORTH }] = { Tiles::UP, Tiles::BLANK };
-	this->adjacencyRules[{ Tiles::BLANK, Direction::EAST }] = { Tiles::RIGHT, Tiles::BLANK };
-	this->adjacencyRules[{ Tiles::BLANK, Direction::WEST }] = { Tiles::LEFT, Tiles::BLANK };
-	this->adjacencyRules[{ Tiles::BLANK, Direction::SOUTH }] = { Tiles::DOWN, Tiles::BLANK };
-
-	this->adjacencyRules[{ Tiles::DOWN, Direction::NORTH }] = { Tiles::BLANK, Tiles::UP};
-	this->adjacencyRules[{ Tiles::DOWN, Direction::EAST }] = { Tiles::DOWN, Tiles::LEFT, Tiles::UP };
-	this->adjacencyRules[{ Tiles::DOWN, Direction::WEST }] = { Tiles::DOWN, Tiles::RIGHT, Tiles::UP };
-	this->adjacencyRules[{ Tiles::DOWN, Direction::SOUTH }] = { Tiles::LEFT, Tiles::RIGHT, Tiles::UP };
-
-	this->adjacencyRules[{ Tiles::LEFT, Direction::NORTH }] = { Tiles::DOWN, Tiles::LEFT, Tiles::RIGHT };
-	this->adjacencyRules[{ Tiles::LEFT, Direction::EAST }] = { Tiles::BLANK, Tiles::RIGHT };
-	this->adjacencyRules[{ Tiles::LEFT, Direction::WEST }] = { Tiles::DOWN, Tiles::RIGHT, Tiles::UP };
-	this->adjacencyRules[{ Tiles::LEFT, Direction::SOUTH }] = { Tiles::LEFT, Tiles::RIGHT, Tiles::UP };
-
-	this->adjacencyRules[{ Tiles::RIGHT, Direction::NORTH }] = { Tiles::DOWN, Tiles::LEFT, Tiles::RIGHT };
-	this->adjacencyRules[{ Tiles::RIGHT, Direction::EAST }] = { Tiles::DOWN, Tiles::LEFT, Tiles::UP };
-	this->adjacencyRules[{ Tiles::RIGHT, Direction::WEST }] = { Tiles::BLANK, Tiles::LEFT };
-	this->adjacencyRules[{ Tiles::RIGHT, Direction::SOUTH }] = { Tiles::LEFT, Tiles::RIGHT, Tiles::UP };
-
-	this->adjacencyRules[{ Tiles::UP, Direction::NORTH }] = { Tiles::DOWN, Tiles::LEFT, Tiles::RIGHT };
-	this->adjacencyRules[{ Tiles::UP, Direction::EAST }] = { Tiles::DOWN, Tiles::LEFT, Tiles::UP };
-	this->adjacencyRules[{ Tiles::UP, Direction::WEST }] = { Tiles::DOWN, Tiles::RIGHT, Tiles::UP };
-	this->adjacencyRules[{ Tiles::UP, Direction::SOUTH }] = { Tiles::BLANK, Tiles::DOWN };
-
+	this->random.Seed(seed);
+	this->engine = engine;
 	this->gridWidth = gridWidth;
 	this->gridHeight = gridHeight;
-	this->grid = std::vector<std::vector<WFCCell>>(gridWidth, std::vector<WFCCell>(gridHeight));
+	this->collapsed.resize(gridWidth * gridHeight);
+	this->tileCounts.resize(gridWidth * gridHeight);
+	this->sumWeights.resize(gridWidth * gridHeight);
+	this->sumWeightLogWeights.resize(gridWidth * gridHeight);
+	this->entropies.resize(gridWidth * gridHeight);
+	this->tieBreaks.resize(gridWidth * gridHeight);
+	this->stamps.resize(gridWidth * gridHeight);
+	if (this->engine == PropagationEngine::UNION) {
+		this->toVisit.Resize(gridWidth * gridHeight);
+	}
+	BuildNeighbors();
 
+	SetRules(std::move(rules));
+}
+
+void WFC::SetBoundary(GridBoundary boundary) {
+	this->boundary = boundary;
+	BuildNeighbors();
+	this->snapshotValid = false;
 	Reset();
+}
+
+void WFC::BuildNeighbors() {
+	// Resolve the edges once here so propagation only has to skip a missing neighbour
+	this->neighbors.resize(this->gridWidth * this->gridHeight * 4);
+	for (int y = 0; y < this->gridHeight; ++y) {
+		for (int x = 0; x < this->gridWidth; ++x) {
+			for (int dir = 0; dir < 4; ++dir) {
+				int newX = x + DIRECTION_DX[dir];
+				int newY = y + DIRECTION_DY[dir];
+				if (this->boundary == GridBoundary::PERIODIC) {
+					newX = (newX + this->gridWidth) % this->gridWidth;
+					newY = (newY + this->gridHeight) % this->gridHeight;
+				}
+				bool inside = newX >= 0 && newX < this->gridWidth && newY >= 0 && newY < this->gridHeight;
+				this->neighbors[CellIndex(x, y) * 4 + dir] = inside ? CellIndex(newX, newY) : -1;
+			}
+		}
+	}
+}
+
+void WFC::SetRules(std::shared_ptr<const RuleSet> rules) {
+	this->rules = std::move(rules);
+	this->snapshotValid = false;
+	this->maskWords = this->rules->maskWords;
+	this->domains.resize(this->gridWidth * this->gridHeight * this->maskWords);
+	this->allowedScratch.resize(this->maskWords);
+	if (this->engine == PropagationEngine::AC4) {
+		this->supports.resize(this->gridWidth * this->gridHeight * this->rules->tileCount * 4);
+	}
 
-	PrintEntropies();
+	Reset();
 }
 
 void WFC::PrintEntropies() {
 	// Print the entropy of each cell in the grid 
 	std::cout << "Entropies:" << std::endl;
+	for (int i = 0; i < this->gridWidth * this->gridHeight; ++i) {
+		std::cout << (Current(i) ? this->entropies[i] : this->snapshot.entropies[i]) << ((i + 1) % this->gridWidth == 0 ? "\n" : " ");
+	}
+	std::cout << std::flush;
+}
+
+void WFC::Collapse(std::vector<std::vector<int>> &outputWFC) {
+	// One observation per call so the window can show the map being built, the call after the
+	// last cell collapses starts a new map
+	if (AllCollapsed()) {
+		Reset();
+	}
+	Step(1);
+	GetOutput(outputWFC);
+}
+
+WFCResult WFC::Solve() {
+	return Step(std::numeric_limits<int>::max());
+}
+
+WFCResult WFC::Step(int observations) {
+	WFCResult result{ WFCStatus::RUNNING, 0, 0, 0 };
+	if (this->snapshot.contradiction) {
+		result.status = WFCStatus::CONTRADICTION;
+		return result;
+	}
+
+	while (!AllCollapsed() && result.steps < observations) {
+		if (!Observe() && !(this->backtracking && Backtrack(result.backtracks))) {
+			if (this->maxRestarts >= 0 && result.restarts >= this->maxRestarts) {
+				result.status = WFCStatus::CONTRADICTION;
+				return result;
+			}
+			Reset();
+			result.restarts++;
+		}
+		result.steps++;
+	}
+
+	if (AllCollapsed()) {
+		result.status = WFCStatus::SUCCESS;
+	}
+	return result;
+}
+
+void WFC::GetOutput(std::vector<std::vector<int>>& output) {
+	// Collapsed cells hold exactly one tile
+	output.resize(this->gridHeight);
 	for (int y = 0; y < this->gridHeight; ++y) {
+		output[y].resize(this->gridWidth);
 		for (int x = 0; x < this->gridWidth; ++x) {
-			std::cout << grid[y][x].entropy << " ";
+			int cell = CellIndex(x, y);
+			if (Current(cell)) {
+				output[y][x] = this->collapsed[cell] ? MaskNth(Domain(cell), this->maskWords, 0) : -1;
+			}
+			else {
+				output[y][x] = this->snapshot.collapsed[cell] ? MaskNth(&this->snapshot.domains[cell * this->maskWords], this->maskWords, 0) : -1;
+			}
+		}
+	}
+}
+
+void WFC::Reset() {
+	if (!this->snapshotValid) {
+		BuildSnapshot();
+	}
+	else if (this->random.InitialSeed() != this->tieBreakSeed || this->random.Stream() != this->tieBreakStream) {
+		// Reseeded since the tie-breaks were drawn, the presolved wave itself doesn't depend on them
+		DrawTieBreaks();
+		OrderSnapshot();
+	}
+	if (this->lazyReset) {
+		// Every stamp is stale now, only a wrap of the counter needs a full pass
+		if (++this->epoch == 0) {
+			std::fill(this->stamps.begin(), this->stamps.end(), 0);
+			this->epoch = 1;
 		}
-		std::cout << std::endl;
+		this->entropyHeap.Clear(this->gridWidth * this->gridHeight);
+		this->untouchedNext = 0;
 	}
+	else {
+		this->domains = this->snapshot.domains;
+		this->collapsed = this->snapshot.collapsed;
+		this->tileCounts = this->snapshot.tileCounts;
+		this->sumWeights = this->snapshot.sumWeights;
+		this->sumWeightLogWeights = this->snapshot.sumWeightLogWeights;
+		this->entropies = this->snapshot.entropies;
+		this->supports = this->snapshot.supports;
+		this->entropyHeap = this->snapshot.entropyHeap;
+		std::fill(this->stamps.begin(), this->stamps.end(), this->epoch);
+		this->untouchedNext = this->untouchedOrder.size();
+	}
+	this->trail.clear();
+	this->decisions.clear();
+	this->backtracksSinceReset = 0;
+	this->bannedTiles.clear();
+	this->banContradiction = false;
 }
 
-void WFC::Collapse(std::vector<std::vector<Tiles>> &outputWFC) {
-	//outputWFC = std::vector<std::vector<Tiles>>(this->gridWidth, std::vector<Tiles>(this->gridHeight, Tiles::BLANK));
-	//Reset();
-	//outputWFC[0][0] = CollapseCell(0, 0);
-	//outputWFC[0][0] = this->grid[0][0].possibleTiles[0];
+void WFC::Pin(int x, int y, int tile) {
+	this->pins.push_back({ CellIndex(x, y), tile });
+	this->snapshotValid = false;
+}
 
-	// Find all cells with entropy > 1
-	// Choose one randomly from these cells
-	int x, y;
-	bool done = false;
-	bool redo = false;
-	bool oneAtATime = true;
-	FindLowestEntropyCell(x, y, done);
-	if (done) {
-		std::cout << "Resetting for new WFC" << std::endl;
-		// Reset the grid and outputWFC
-		this->Reset();
-		outputWFC = std::vector<std::vector<Tiles>>(this->gridWidth, std::vector<Tiles>(this->gridHeight, Tiles::BLANK));
+void WFC::ClearPins() {
+	this->pins.clear();
+	this->snapshotValid = false;
+}
+
+void WFC::BuildSnapshot() {
+	// Built in the live arrays, so every cell is current while it runs
+	std::fill(this->stamps.begin(), this->stamps.end(), this->epoch);
+	this->untouchedNext = this->untouchedOrder.size();
+
+	// Every tile everywhere
+	const TileMask* allTiles = this->rules->AllTiles();
+	for (int cell = 0; cell < this->gridWidth * this->gridHeight; ++cell) {
+		std::copy(allTiles, allTiles + this->maskWords, Domain(cell));
+	}
+	std::fill(this->collapsed.begin(), this->collapsed.end(), 0);
+	std::fill(this->tileCounts.begin(), this->tileCounts.end(), this->rules->tileCount);
+	std::fill(this->sumWeights.begin(), this->sumWeights.end(), this->rules->initialSumWeights);
+	std::fill(this->sumWeightLogWeights.begin(), this->sumWeightLogWeights.end(), this->rules->initialSumWeightLogWeights);
+	std::fill(this->entropies.begin(), this->entropies.end(), this->rules->initialEntropy);
+
+	DrawTieBreaks();
+	std::vector<EntropyKey> keys(this->entropies.size());
+	for (size_t cell = 0; cell < keys.size(); ++cell) {
+		keys[cell] = { this->entropies[cell], this->tieBreaks[cell] };
+	}
+	this->entropyHeap.Build(keys);
+	this->bannedTiles.clear();
+	this->banContradiction = false;
+
+	const int tileCount = this->rules->tileCount;
+	if (this->engine == PropagationEngine::AC4) {
+		const int supportsPerCell = tileCount * 4;
+		const int* initialSupport = this->rules->InitialSupport();
+		for (int cell = 0; cell < this->gridWidth * this->gridHeight; ++cell) {
+			std::copy(initialSupport, initialSupport + supportsPerCell, &this->supports[cell * supportsPerCell]);
+		}
 	}
 
-	while (done == false) {
-		FindLowestEntropyCell(x, y, done);
-		if (done) {
-			std::cout << "All cells collapsed" << std::endl;
-			return;
+	bool contradiction = false;
+	for (auto [cell, tile] : this->pins) {
+		if (!MaskTest(Domain(cell), tile)) {
+			contradiction = true;
+			break;
 		}
+		// Propagation skips collapsed cells, so pins next to each other are checked here
+		for (int dir = 0; dir < 4; ++dir) {
+			int neighbor = this->neighbors[cell * 4 + dir];
+			if (neighbor < 0) continue;
+			if (this->collapsed[neighbor] && !MaskTest(this->rules->Compatible(tile, dir), MaskNth(Domain(neighbor), this->maskWords, 0))) {
+				contradiction = true;
+			}
+		}
+		if (contradiction) break;
+		this->collapsed[cell] = 1;
+		this->entropies[cell] = std::numeric_limits<float>::infinity();
+		this->entropyHeap.Remove(cell);
+		for (int t = 0; t < tileCount; ++t) {
+			if (t != tile && MaskTest(Domain(cell), t)) {
+				RemoveTile(cell, t);
+			}
+		}
+	}
 
-		// Collapse that cell and set the outputWFC[x][y] to the tile
-		outputWFC[y][x] = CollapseCell(x, y);
+	if (!contradiction && this->engine == PropagationEngine::AC4) {
+		// Supports only ever count down, so a tile that starts with none from a neighbour that
+		// exists would never be banned by RemoveTile; ban those up front
+		const int* initialSupport = this->rules->InitialSupport();
+		for (int cell = 0; cell < this->gridWidth * this->gridHeight; ++cell) {
+			for (int dir = 0; dir < 4; ++dir) {
+				// supports[t][dir] count tiles in the neighbour at -dir
+				if (this->neighbors[cell * 4 + (dir + 2) % 4] < 0) continue;
+				for (int tile = 0; tile < tileCount; ++tile) {
+					if (initialSupport[tile * 4 + dir] == 0 && MaskTest(Domain(cell), tile)) {
+						this->bannedTiles.push_back({ cell, tile });
+					}
+				}
+			}
+		}
+		bool redo = false;
+		PropagateBans(redo);
+		contradiction = redo;
+	}
+	else if (!contradiction) {
+		// Propagate out of every cell once, which also carries the pins' bans as far as they go
+		for (int cell = 0; cell < this->gridWidth * this->gridHeight && !contradiction; ++cell) {
+			UpdateEntropies(cell % this->gridWidth, cell / this->gridWidth, contradiction);
+		}
+	}
 
-		// Update the entropies of the neighboring cells
-		UpdateEntropies(x, y, redo);
-		if (redo) {
-			std::cout << "Redoing..." << std::endl;
-			// Reset the grid and outputWFC
-			this->Reset();
-			outputWFC = std::vector<std::vector<Tiles>>(this->gridWidth, std::vector<Tiles>(this->gridHeight, Tiles::BLANK));
+	this->snapshot.domains = this->domains;
+	this->snapshot.collapsed = this->collapsed;
+	this->snapshot.tileCounts = this->tileCounts;
+	this->snapshot.sumWeights = this->sumWeights;
+	this->snapshot.sumWeightLogWeights = this->sumWeightLogWeights;
+	this->snapshot.entropies = this->entropies;
+	this->snapshot.supports = this->supports;
+	this->snapshot.contradiction = contradiction;
+	this->snapshotValid = true;
+	OrderSnapshot();
+	this->untouchedNext = this->untouchedOrder.size();
+}
+
+void WFC::DrawTieBreaks() {
+	// A shuffled rank per cell orders cells of equal entropy uniformly at random. Its own
+	// generator keeps it a function of (seed, stream) and leaves random to the tile choices.
+	this->tieBreakSeed = this->random.InitialSeed();
+	this->tieBreakStream = this->random.Stream();
+	Random shuffle(this->tieBreakSeed ^ 0x9E3779B97F4A7C15ULL, this->tieBreakStream);
+	for (uint32_t cell = 0; cell < this->tieBreaks.size(); ++cell) {
+		this->tieBreaks[cell] = cell;
+	}
+	for (uint32_t cell = static_cast<uint32_t>(this->tieBreaks.size()); cell > 1; --cell) {
+		std::swap(this->tieBreaks[cell - 1], this->tieBreaks[shuffle.NextUInt(cell)]);
+	}
+}
+
+void WFC::OrderSnapshot() {
+	// Queue the snapshot's uncollapsed cells by entropy and tie-break, both in the heap a full
+	// Reset copies and as the sorted order a lazy Reset takes untouched cells from
+	std::vector<EntropyKey> keys(this->snapshot.entropies.size());
+	for (size_t cell = 0; cell < keys.size(); ++cell) {
+		keys[cell] = { this->snapshot.entropies[cell], this->tieBreaks[cell] };
+	}
+	this->snapshot.entropyHeap.Build(keys);
+	this->untouchedOrder.clear();
+	for (int cell = 0; cell < this->gridWidth * this->gridHeight; ++cell) {
+		if (this->snapshot.collapsed[cell]) {
+			this->snapshot.entropyHeap.Remove(cell);
 		}
-		if (oneAtATime = true) {
-			break;
+		else {
+			this->untouchedOrder.push_back(cell);
 		}
-	// Repeat until all cells collapsed or a cell has 0 valid tiles
 	}
+	std::sort(this->untouchedOrder.begin(), this->untouchedOrder.end(), [&](int a, int b) {
+		return keys[a] < keys[b];
+	});
+}
 
-	//std::cout << std::endl;
-	//std::cout << "Collapsed" << std::endl;
-	//for (int y = 0; y < this->gridHeight; ++y) {
-	//	for (int x = 0; x < this->gridWidth; ++x) {
-	//		std::cout << static_cast<int>(outputWFC[y][x]) << " ";
-	//	}
-	//	std::cout << std::endl;
-	//}
-	//PrintEntropies();
+void WFC::Materialize(int cell) {
+	// First touch since a lazy Reset, copy the cell's snapshot state in
+	this->stamps[cell] = this->epoch;
+	std::copy_n(&this->snapshot.domains[cell * this->maskWords], this->maskWords, Domain(cell));
+	this->collapsed[cell] = this->snapshot.collapsed[cell];
+	this->tileCounts[cell] = this->snapshot.tileCounts[cell];
+	this->sumWeights[cell] = this->snapshot.sumWeights[cell];
+	this->sumWeightLogWeights[cell] = this->snapshot.sumWeightLogWeights[cell];
+	this->entropies[cell] = this->snapshot.entropies[cell];
+	if (this->engine == PropagationEngine::AC4) {
+		const int supportsPerCell = this->rules->tileCount * 4;
+		std::copy_n(&this->snapshot.supports[cell * supportsPerCell], supportsPerCell, &this->supports[cell * supportsPerCell]);
+	}
+	if (!this->collapsed[cell]) {
+		this->entropyHeap.Update(cell, { this->entropies[cell], this->tieBreaks[cell] });
+	}
+}
 
+bool WFC::AllCollapsed() {
+	// Untouched cells that are queued in the snapshot count as uncollapsed
+	while (this->untouchedNext < this->untouchedOrder.size() && Current(this->untouchedOrder[this->untouchedNext])) {
+		this->untouchedNext++;
+	}
+	return this->entropyHeap.Empty() && this->untouchedNext == this->untouchedOrder.size();
 }
 
 // Privates
 
-void WFC::Reset() {
-	for (int y = 0; y < this->gridHeight; ++y) {
-		for (int x = 0; x < this->gridWidth; ++x) {
-			this->grid[y][x] = WFCCell{ {Tiles::BLANK, Tiles::DOWN, Tiles::LEFT, Tiles::RIGHT, Tiles::UP}, false, 5.0f };
-		}
+bool WFC::Observe() {
+	// Collapse the lowest entropy cell and propagate, false if that left a cell with no tiles
+	int x, y;
+	bool done = false;
+	bool redo = false;
+	FindLowestEntropyCell(x, y, done);
+	if (done) {
+		return true;
+	}
+	size_t trailSize = this->trail.size();
+	int tile = CollapseCell(x, y);
+	if (this->backtracking) {
+		this->decisions.push_back({ CellIndex(x, y), tile, trailSize });
 	}
+	UpdateEntropies(x, y, redo);
+	return !redo;
 }
 
 void WFC::FindLowestEntropyCell(int& x, int& y, bool& done) {
-	float minEntropy = std::numeric_limits<float>::max();
-	std::vector<std::pair<int, int>> candidates;
+	if (AllCollapsed()) {
+		done = true;
+		return;
+	}
+	// The lowest untouched cell still has its snapshot key, compare it with the live heap
+	if (this->untouchedNext < this->untouchedOrder.size()) {
+		int untouched = this->untouchedOrder[this->untouchedNext];
+		if (this->entropyHeap.Empty() || EntropyKey{ this->snapshot.entropies[untouched], this->tieBreaks[untouched] } < this->entropyHeap.TopKey()) {
+			Materialize(untouched);
+		}
+	}
+	int cell = this->entropyHeap.Top();
+	x = cell % this->gridWidth;
+	y = cell / this->gridWidth;
+	done = false;
+	return;
+}
 
-	for (int y = 0; y < this->gridHeight; ++y) {
-		for (int x = 0; x < this->gridWidth; ++x) {
-			const WFCCell& cell = this->grid[y][x];
-			if (cell.collapsed) continue;
+void WFC::SetEntropy(int cell, float entropy) {
+	this->entropies[cell] = entropy;
+	this->entropyHeap.Update(cell, { entropy, this->tieBreaks[cell] });
+}
+
+void WFC::RemoveTile(int cell, int tile) {
+	// Every domain change goes through here so the trail can replay it backwards in UndoTrail.
+	// O(1) bookkeeping for one removed tile, the entropy itself is derived from the totals.
+	MaskClear(Domain(cell), tile);
+	this->tileCounts[cell]--;
+	this->sumWeights[cell] -= this->rules->weights[tile];
+	this->sumWeightLogWeights[cell] -= this->rules->weightLogWeights[tile];
+	if (this->backtracking) {
+		this->trail.push_back({ cell, tile });
+	}
 
-			if (cell.entropy < minEntropy) {
-				minEntropy = cell.entropy;
-				candidates.clear();
-				candidates.push_back({ x, y });
+	if (this->engine == PropagationEngine::AC4) {
+		// The removed tile takes one unit of support away from every tile it allowed next door.
+		// A neighbour tile with no support left from some direction can't be placed anymore.
+		const int tileCount = this->rules->tileCount;
+		for (int dir = 0; dir < 4; ++dir) {
+			int neighbor = this->neighbors[cell * 4 + dir];
+			if (neighbor < 0) continue;
+			Touch(neighbor);
+			const TileMask* neighborTiles = Domain(neighbor);
+			int* neighborSupports = &this->supports[neighbor * tileCount * 4];
+			for (int t : this->rules->CompatibleList(tile, dir)) {
+				if (--neighborSupports[t * 4 + dir] == 0 && MaskTest(neighborTiles, t)) {
+					this->bannedTiles.push_back({ neighbor, t });
+				}
 			}
-			else if (cell.entropy == minEntropy) {
-				candidates.push_back({ x, y });
+		}
+	}
+}
+
+void WFC::UndoTrail(size_t trailSize) {
+	// Put removed tiles back newest first, the exact reverse of RemoveTile
+	const int tileCount = this->rules->tileCount;
+	while (this->trail.size() > trailSize) {
+		auto [cell, tile] = this->trail.back();
+		this->trail.pop_back();
+
+		MaskSet(Domain(cell), tile);
+		this->tileCounts[cell]++;
+		this->sumWeights[cell] += this->rules->weights[tile];
+		this->sumWeightLogWeights[cell] += this->rules->weightLogWeights[tile];
+		if (!this->collapsed[cell]) {
+			SetEntropy(cell, ShannonEntropy(this->sumWeights[cell], this->sumWeightLogWeights[cell]));
+		}
+
+		if (this->engine == PropagationEngine::AC4) {
+			for (int dir = 0; dir < 4; ++dir) {
+				int neighbor = this->neighbors[cell * 4 + dir];
+				if (neighbor < 0) continue;
+
+				int* neighborSupports = &this->supports[neighbor * tileCount * 4];
+				for (int t : this->rules->CompatibleList(tile, dir)) {
+					neighborSupports[t * 4 + dir]++;
+				}
 			}
 		}
 	}
+}
 
-	if (candidates.empty()) {
-		done = true;
-		return;
+bool WFC::Backtrack(int& backtracks) {
+	// Undo to the most recent decision and rule its tile out. If that contradicts as well, keep
+	// unwinding. False once there is nothing left to undo or the backtrack budget is spent.
+	while (!this->decisions.empty() && this->backtracksSinceReset < this->maxBacktracks) {
+		Decision decision = this->decisions.back();
+		this->decisions.pop_back();
+		this->backtracksSinceReset++;
+		backtracks++;
+
+		this->bannedTiles.clear();
+		this->banContradiction = false;
+		UndoTrail(decision.trailSize);
+		this->collapsed[decision.cell] = 0;
+		SetEntropy(decision.cell, ShannonEntropy(this->sumWeights[decision.cell], this->sumWeightLogWeights[decision.cell]));
+
+		bool redo = false;
+		Ban(decision.cell, decision.tile);
+		if (this->banContradiction) {
+			continue;
+		}
+		UpdateEntropies(decision.cell % this->gridWidth, decision.cell / this->gridWidth, redo);
+		if (!redo) {
+			return true;
+		}
 	}
-	int randomIndex = rand() % candidates.size();
-	x = candidates[randomIndex].first;
-	y = candidates[randomIndex].second;
-	done = false;
-	return;
+	return false;
 }
 
-Tiles WFC::CollapseCell(int x, int y) {
+int WFC::CollapseCell(int x, int y) {
 	// Collapse the cell at (x, y) to a random tile
-	this->grid[y][x].collapsed = true;
-	this->grid[y][x].entropy = 1.0f; // Set entropy to 1 after collapsing
+	int cell = CellIndex(x, y);
+	this->collapsed[cell] = 1;
+	this->entropies[cell] = std::numeric_limits<float>::infinity();
+	this->entropyHeap.Remove(cell); // drop out of the lowest entropy search
+
+	// Randomly select a tile from the possible tiles, weighted by tile frequency
+	TileMask* domain = Domain(cell);
+	std::span<const double> weights = this->rules->weights;
+	double target = this->sumWeights[cell] * this->random.NextDouble();
+	int tile = -1;
+	for (int word = 0; word < this->maskWords; ++word) {
+		for (TileMask remaining = domain[word]; remaining != 0; remaining &= remaining - 1) {
+			tile = word * TILE_MASK_BITS + std::countr_zero(remaining);
+			target -= weights[tile];
+			if (target < 0.0) break;
+		}
+		if (target < 0.0) break;
+	}
 
-	// Randomly select a tile from the possible tiles
-	int randomIndex = rand() % (this->grid[y][x].possibleTiles.size());
-	//std::cout << "size: " << this->grid[x][y].possibleTiles.size() << std::endl;
-	//std::cout << "randomly collapsing cell at (" << x << ", " << y << ")" << ": " << randomIndex << ", " << static_cast<int>(this->grid[x][y].possibleTiles[randomIndex]) << std::endl;
-	this->grid[y][x].possibleTiles = { this->grid[y][x].possibleTiles[randomIndex] };
-	return this->grid[y][x].possibleTiles[0];
+	for (int word = 0; word < this->maskWords; ++word) {
+		for (TileMask remaining = domain[word]; remaining != 0; remaining &= remaining - 1) {
+			int t = word * TILE_MASK_BITS + std::countr_zero(remaining);
+			if (t != tile) {
+				RemoveTile(cell, t);
+			}
+		}
+	}
+	return tile;
 }
 
 void WFC::UpdateEntropies(int startX, int startY, bool& redo) {
-	// Update the entropies of the neighboring cells
-	std::queue<std::pair<int, int>> toVisit;
-	toVisit.push({startX, startY}); // starting point
-
-	std::vector<std::pair<std::string, std::pair<int, int>>> directions = {
-		{"NORTH",	{ 0, -1}},
-		{"EAST",	{ 1,  0}},
-		{"SOUTH",	{ 0,  1}},
-		{"WEST",	{-1,  0}}
-	};
+	if (this->engine == PropagationEngine::AC4) {
+		PropagateBans(redo);
+		return;
+	}
 
-	while (!toVisit.empty()) {
-		auto [x, y] = toVisit.front();
-		toVisit.pop();
-		
-		WFCCell& currentCell = this->grid[y][x];
+	// Update the entropies of the neighboring cells
+	this->toVisit.Push(CellIndex(startX, startY)); // starting point
 
-		// for each neighbor
-		for (auto [dir, offset] : directions) {
-			int newX = x + offset.first;
-			int newY = y + offset.second;
+	TileMask* allowedNeighborTiles = this->allowedScratch.data();
 
-			// check for edges
-			if (newX < 0 || newX >= this->gridWidth || newY < 0 || newY >= this->gridHeight) continue;
+	while (!this->toVisit.Empty()) {
+		int cell = this->toVisit.Pop();
+		const TileMask* currentTiles = Domain(cell);
+		const int* cellNeighbors = &this->neighbors[cell * 4];
 
-			WFCCell& neighbor = this->grid[newY][newX];
+		// for each neighbor, none past a clamped edge
+		for (int dir = 0; dir < 4; ++dir) {
+			int neighbor = cellNeighbors[dir];
+			if (neighbor < 0) continue;
+			Touch(neighbor);
 
-			if (neighbor.collapsed) continue;
-			
+			if (this->collapsed[neighbor]) continue;
 
-			bool changed = false;
-			//Update neighbor possibleTiles
-
-			std::set<Tiles> allowedNeighborTiles = {};
-			for (auto tile : currentCell.possibleTiles) {
-				if (dir == "NORTH") {
-					std::vector<Tiles> toAdd = adjacencyRules[{tile, Direction::NORTH}];
-					for (auto t : toAdd) {
-						allowedNeighborTiles.insert(t);
-					}
-				}
-				else if (dir == "EAST") {
-					std::vector<Tiles> toAdd = adjacencyRules[{tile, Direction::EAST}];
-					for (auto t : toAdd) {
-						allowedNeighborTiles.insert(t);
-					}
-				}
-				else if (dir == "SOUTH") {
-					std::vector<Tiles> toAdd = adjacencyRules[{tile, Direction::SOUTH}];
-					for (auto t : toAdd) {
-						allowedNeighborTiles.insert(t);
-					}
-				}
-				else if (dir == "WEST") {
-					std::vector<Tiles> toAdd = adjacencyRules[{tile, Direction::WEST}];
-					for (auto t : toAdd) {
-						allowedNeighborTiles.insert(t);
+			// Union of the compiled compatibility masks of every tile still possible here
+			if (this->rules->HasMaskTable()) {
+				allowedNeighborTiles[0] = this->rules->AllowedNeighbors(currentTiles[0], dir);
+			}
+			else {
+				std::fill(allowedNeighborTiles, allowedNeighborTiles + this->maskWords, 0);
+				for (int word = 0; word < this->maskWords; ++word) {
+					for (TileMask remaining = currentTiles[word]; remaining != 0; remaining &= remaining - 1) {
+						int tile = word * TILE_MASK_BITS + std::countr_zero(remaining);
+						const TileMask* compatible = this->rules->Compatible(tile, dir);
+						for (int w = 0; w < this->maskWords; ++w) {
+							allowedNeighborTiles[w] |= compatible[w];
+						}
 					}
 				}
 			}
 
-
-			// Check if the neighbor cell's possible tiles are a subset of the allowed tiles
-			std::vector<Tiles> newPossibleTiles;
-			for (auto tile : neighbor.possibleTiles) {
-				if (allowedNeighborTiles.count(tile)) { //if it's found, add it to the new possible tiles
-					newPossibleTiles.push_back(tile);
-				}
-				else {
-					changed = true; //if it's not found, we need to update the entropy
+			// Drop every neighbor tile that isn't allowed next to any of our possible tiles
+			TileMask* neighborTiles = Domain(neighbor);
+			bool changed = false;
+			for (int word = 0; word < this->maskWords; ++word) {
+				for (TileMask removed = neighborTiles[word] & ~allowedNeighborTiles[word]; removed != 0; removed &= removed - 1) {
+					RemoveTile(neighbor, word * TILE_MASK_BITS + std::countr_zero(removed));
+					changed = true;
 				}
 			}
 
 			if (changed) {
-				if (newPossibleTiles.empty()) {
+				if (this->tileCounts[neighbor] == 0) {
 					redo = true;
-					std::cout << "HELLO BAD" << std::endl;
-					//throw std::runtime_error("No valid tiles left for neighbor cell at (" + std::to_string(newX) + ", " + std::to_string(newY) + ")");
+					this->toVisit.Clear();
+					return;
 				}
-
-				neighbor.possibleTiles = std::move(newPossibleTiles);
-				neighbor.entropy = static_cast<float>(neighbor.possibleTiles.size());
-				if (neighbor.entropy == 1.0f) {
-					neighbor.entropy = 1.1f; // Set to 1.1 to avoid infinite loop
+				else {
+					SetEntropy(neighbor, ShannonEntropy(this->sumWeights[neighbor], this->sumWeightLogWeights[neighbor]));
 				}
-				toVisit.push({ newX, newY });
+				this->toVisit.Push(neighbor);
 			}
 		}
 
 	}
-}
\ No newline at end of file
+}
+
+void WFC::Ban(int cell, int tile) {
+	RemoveTile(cell, tile);
+	if (this->tileCounts[cell] == 0) {
+		this->banContradiction = true;
+	}
+	else if (!this->collapsed[cell]) {
+		SetEntropy(cell, ShannonEntropy(this->sumWeights[cell], this->sumWeightLogWeights[cell]));
+	}
+}
+
+void WFC::PropagateBans(bool& redo) {
+	// RemoveTile queues every tile whose support ran out, ban them until nothing is left
+	while (!this->bannedTiles.empty() && !this->banContradiction) {
+		auto [cell, tile] = this->bannedTiles.back();
+		this->bannedTiles.pop_back();
+		if (MaskTest(Domain(cell), tile)) {
+			Ban(cell, tile);
+		}
+	}
+
+	if (this->banContradiction) {
+		redo = true;
+		this->bannedTiles.clear();
+		this->banContradiction = false;
+	}
+}
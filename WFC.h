@@ -1,23 +1,160 @@
 #pragma once
-#include <map>
+#include <memory>
 #include <utility>
 #include <iostream>
 #include "WFCUtility.h"
+#include "RuleSet.h"
+#include "EntropyHeap.h"
+#include "CellQueue.h"
+#include "Random.h"
+
+// How UpdateEntropies narrows the neighbours of a changed cell
+enum class PropagationEngine {
+	UNION, // recompute the union of allowed tiles for every neighbour of each dequeued cell
+	AC4 // per-cell, per-tile, per-direction support counters, only removed tiles are processed
+};
+
+// What lies past the edge of the grid
+enum class GridBoundary {
+	CLAMPED, // nothing, edge cells have fewer neighbours
+	PERIODIC // the opposite edge, for maps that tile seamlessly
+};
+
+enum class WFCStatus {
+	RUNNING, // observation budget ran out before every cell collapsed
+	SUCCESS, // every cell collapsed
+	CONTRADICTION // a cell ran out of tiles after maxRestarts restarts
+};
+
+struct WFCResult {
+	WFCStatus status;
+	int steps; // observations made by this call
+	int restarts; // restarts after a contradiction made by this call
+	int backtracks; // decisions undone by this call
+};
 
 class WFC {
 public:
 	int gridWidth;
 	int gridHeight;
-	std::vector<std::vector<WFCCell>> grid;
-	// create map from (tile, direction) -> vector of tiles
-	std::map < std::pair<Tiles, Direction>, std::vector<Tiles> > adjacencyRules;
+	// Grid state as parallel row-major arrays, cell (x, y) lives at index y * gridWidth + x.
+	// With lazyReset a cell not touched since the last Reset still holds an older map's state,
+	// read the map through GetOutput.
+	std::vector<TileMask> domains; // maskWords words per cell
+	std::vector<uint8_t> collapsed;
+	std::vector<int> tileCounts; // number of possible tiles
+	std::vector<double> sumWeights; // running sum(w) over the possible tiles
+	std::vector<double> sumWeightLogWeights; // running sum(w * log w) over the possible tiles
+	std::vector<float> entropies; // Shannon entropy of the possible tiles, +inf once collapsed
+	// compiled adjacency rules, shareable between instances
+	std::shared_ptr<const RuleSet> rules;
+	int maskWords;
+	PropagationEngine engine;
+	GridBoundary boundary = GridBoundary::CLAMPED; // change through SetBoundary
+	int maxRestarts = -1; // restarts a Solve/Step call may make before giving up, -1 for no limit
+	// On contradiction undo to the last decision and ban its tile instead of restarting, up to
+	// maxBacktracks undone decisions before falling back to a restart
+	bool backtracking = false;
+	int maxBacktracks = 1000;
+	// Reset only starts a new epoch instead of copying the whole snapshot back, cells are copied
+	// from the snapshot when first touched. For large maps where most restarts come early.
+	bool lazyReset = false;
+
+	// Every random choice comes from this solver's own generator, so a map depends only on
+	// (seed, stream, rules, size). Reseed with random.Seed(seed, stream) between solves, the
+	// next Reset picks the new seed up; solvers running in parallel should use the same seed
+	// with different streams.
+	Random random;
 
-	WFC(int gridWidth, int gridHeight);
-	void Collapse(std::vector<std::vector<Tiles>> &outputWFC);
+	WFC(int gridWidth, int gridHeight, std::shared_ptr<const RuleSet> rules = RuleSet::TrackRules(), PropagationEngine engine = PropagationEngine::UNION, uint64_t seed = 1);
+	void Collapse(std::vector<std::vector<int>> &outputWFC);
+	// Run until every cell is collapsed (or maxRestarts is hit)
+	WFCResult Solve();
+	// Make at most observations observations, restarting on contradiction
+	WFCResult Step(int observations);
+	// Tile id of every cell, -1 where the cell isn't collapsed yet
+	void GetOutput(std::vector<std::vector<int>>& output);
+	// Start a new map from the initial wave snapshot
+	void Reset();
+	// Switch to another ruleset, e.g. a newer published version, and start a new map with it
+	void SetRules(std::shared_ptr<const RuleSet> rules);
+	// Switch between clamped and wrap-around edges and start a new map
+	void SetBoundary(GridBoundary boundary);
+	// Fix cell (x, y) to tile in every map from the next Reset on
+	void Pin(int x, int y, int tile);
+	void ClearPins();
 	void PrintEntropies();
 private:
-	void Reset();
+	std::vector<TileMask> allowedScratch; // one domain worth of words for UpdateEntropies
+	CellQueue toVisit; // cells whose narrowed domain still has to reach the neighbours
+	// uncollapsed cells ordered by entropy, equal entropies by a random per-cell rank
+	EntropyHeap entropyHeap;
+	// A random permutation of the cells from a generator of its own seeded from random's
+	// (seed, stream), redrawn on the first Reset after a reseed
+	std::vector<uint32_t> tieBreaks;
+	uint64_t tieBreakSeed = 0;
+	uint64_t tieBreakStream = 0;
+	// Cell next to each cell in each direction for the current boundary, -1 past a clamped edge
+	std::vector<int> neighbors; // [cell][direction]
+
+	// AC-4 state
+	std::vector<int> supports; // [cell][tile][direction]
+	std::vector<std::pair<int, int>> bannedTiles; // (cell, tile) pairs whose support ran out, still to be banned
+	bool banContradiction = false;
+
+	// Backtracking state, every removed tile in order plus where each decision started on it
+	struct Decision {
+		int cell;
+		int tile;
+		size_t trailSize;
+	};
+	std::vector<std::pair<int, int>> trail; // (cell, tile)
+	std::vector<Decision> decisions;
+	int backtracksSinceReset = 0;
+
+	// The wave every map starts from: pins applied and propagated, and tiles without support from
+	// an existing neighbour pruned, so a restart only copies it back. Built on the first Reset
+	// after construction, SetRules or a pin change.
+	struct Snapshot {
+		std::vector<TileMask> domains;
+		std::vector<uint8_t> collapsed;
+		std::vector<int> tileCounts;
+		std::vector<double> sumWeights;
+		std::vector<double> sumWeightLogWeights;
+		std::vector<float> entropies;
+		std::vector<int> supports;
+		EntropyHeap entropyHeap;
+		bool contradiction = false; // the pins can't all hold, every map fails
+	};
+	Snapshot snapshot;
+	bool snapshotValid = false;
+	std::vector<std::pair<int, int>> pins; // (cell, tile)
+
+	// A cell whose stamp isn't the current epoch is in its snapshot state. Uncollapsed snapshot
+	// cells in key order stand in for the heap entries of cells nobody touched yet.
+	std::vector<uint32_t> stamps;
+	uint32_t epoch = 0;
+	std::vector<int> untouchedOrder;
+	size_t untouchedNext = 0;
+
+	void BuildSnapshot();
+	void DrawTieBreaks();
+	void OrderSnapshot();
+	void BuildNeighbors();
+	int CellIndex(int x, int y) const { return y * this->gridWidth + x; }
+	TileMask* Domain(int cell) { return &this->domains[cell * this->maskWords]; }
+	bool Current(int cell) const { return this->stamps[cell] == this->epoch; }
+	void Touch(int cell) { if (!Current(cell)) Materialize(cell); }
+	void Materialize(int cell);
+	bool AllCollapsed();
+	void SetEntropy(int cell, float entropy);
+	void RemoveTile(int cell, int tile);
+	void UndoTrail(size_t trailSize);
+	bool Backtrack(int& backtracks);
+	bool Observe();
 	void FindLowestEntropyCell(int &x, int &y, bool& done);
-	Tiles CollapseCell(int x, int y);
+	int CollapseCell(int x, int y);
 	void UpdateEntropies(int x, int y, bool& redo);
+	void PropagateBans(bool& redo);
+	void Ban(int cell, int tile);
 };    
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 #include <vector>
+#include <bit>
+#include <cstdint>
+#include <cmath>
 
 enum class Direction {
 	NORTH = 0,
@@ -8,6 +11,10 @@ enum class Direction {
 	WEST = 3
 };
 
+// Grid offsets per Direction, y grows downwards so NORTH is y - 1
+constexpr int DIRECTION_DX[4] = { 0, 1, 0, -1 };
+constexpr int DIRECTION_DY[4] = { -1, 0, 1, 0 };
+
 enum class Tiles {
 	BLANK = 0,
 	DOWN = 4,
@@ -16,8 +23,89 @@ enum class Tiles {
 	UP = 1
 };
 
-typedef struct {
-	std::vector<Tiles> possibleTiles;
-	bool collapsed;
-	float entropy; //currently just the number of possible tiles
-} WFCCell;
\ No newline at end of file
+// A cell's domain is a bitmask with one bit per tile id (bit i set = tile i still possible).
+// One word covers any tileset of up to 64 tiles; wider tilesets lay several words end to end
+// and go through the Mask* helpers below, which take the word count explicitly.
+typedef uint64_t TileMask;
+constexpr int TILE_MASK_BITS = 64;
+
+constexpr TileMask TileBit(int tile) {
+	return TileMask(1) << tile;
+}
+
+constexpr TileMask TileBit(Tiles tile) {
+	return TileBit(static_cast<int>(tile));
+}
+
+// Built-in track tileset, TRACK_RULES[tile][direction] = tiles allowed in that direction
+constexpr int TRACK_TILE_COUNT = 5;
+constexpr TileMask TRACK_RULES[TRACK_TILE_COUNT][4] = {
+	// BLANK
+	{ TileBit(Tiles::UP) | TileBit(Tiles::BLANK),
+	  TileBit(Tiles::RIGHT) | TileBit(Tiles::BLANK),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::BLANK),
+	  TileBit(Tiles::LEFT) | TileBit(Tiles::BLANK) },
+	// UP
+	{ TileBit(Tiles::DOWN) | TileBit(Tiles::LEFT) | TileBit(Tiles::RIGHT),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::LEFT) | TileBit(Tiles::UP),
+	  TileBit(Tiles::BLANK) | TileBit(Tiles::DOWN),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::RIGHT) | TileBit(Tiles::UP) },
+	// LEFT
+	{ TileBit(Tiles::DOWN) | TileBit(Tiles::LEFT) | TileBit(Tiles::RIGHT),
+	  TileBit(Tiles::BLANK) | TileBit(Tiles::RIGHT),
+	  TileBit(Tiles::LEFT) | TileBit(Tiles::RIGHT) | TileBit(Tiles::UP),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::RIGHT) | TileBit(Tiles::UP) },
+	// RIGHT
+	{ TileBit(Tiles::DOWN) | TileBit(Tiles::LEFT) | TileBit(Tiles::RIGHT),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::LEFT) | TileBit(Tiles::UP),
+	  TileBit(Tiles::LEFT) | TileBit(Tiles::RIGHT) | TileBit(Tiles::UP),
+	  TileBit(Tiles::BLANK) | TileBit(Tiles::LEFT) },
+	// DOWN
+	{ TileBit(Tiles::BLANK) | TileBit(Tiles::UP),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::LEFT) | TileBit(Tiles::UP),
+	  TileBit(Tiles::LEFT) | TileBit(Tiles::RIGHT) | TileBit(Tiles::UP),
+	  TileBit(Tiles::DOWN) | TileBit(Tiles::RIGHT) | TileBit(Tiles::UP) }
+};
+
+// index of the n-th (0 based) set bit in mask
+inline int NthTile(TileMask mask, int n) {
+	for (; n > 0; --n) {
+		mask &= mask - 1;
+	}
+	return std::countr_zero(mask);
+}
+
+// Multi-word masks for tilesets with more than 64 tiles
+
+inline int MaskWords(int tileCount) {
+	return (tileCount + TILE_MASK_BITS - 1) / TILE_MASK_BITS;
+}
+
+inline bool MaskTest(const TileMask* mask, int tile) {
+	return (mask[tile / TILE_MASK_BITS] >> (tile % TILE_MASK_BITS)) & 1;
+}
+
+inline void MaskSet(TileMask* mask, int tile) {
+	mask[tile / TILE_MASK_BITS] |= TileMask(1) << (tile % TILE_MASK_BITS);
+}
+
+inline void MaskClear(TileMask* mask, int tile) {
+	mask[tile / TILE_MASK_BITS] &= ~(TileMask(1) << (tile % TILE_MASK_BITS));
+}
+
+inline int MaskNth(const TileMask* mask, int words, int n) {
+	for (int i = 0; i < words; ++i) {
+		int count = std::popcount(mask[i]);
+		if (n < count) {
+			return i * TILE_MASK_BITS + NthTile(mask[i], n);
+		}
+		n -= count;
+	}
+	return -1;
+}
+
+// Shannon entropy of a domain from its running totals sum(w) and sum(w * log w):
+// H = log(sum w) - sum(w log w) / sum w
+inline float ShannonEntropy(double sumWeights, double sumWeightLogWeights) {
+	return static_cast<float>(std::log(sumWeights) - sumWeightLogWeights / sumWeights);
+}
@@ -8,6 +8,7 @@
 #include <sstream>
 #include <print>
 #include "WFC.h"
+#include "TileSet.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -16,8 +17,9 @@ bool spacePressedLastFrame = false;
 const int gridWidth = 5;
 const int gridHeight = 5;
 const int tileSize = 160;
-std::vector<std::vector<Tiles>> outputWFC;
+std::vector<std::vector<int>> outputWFC;
 std::unique_ptr<WFC> wfc;
+TileSet tileSet;
 
 void randomWFC() {
     //for (int y = 0; y < gridHeight; ++y) {
@@ -38,17 +40,11 @@ void randomWFC() {
 }
 void newWFC() {
     // Initialize the outputWFC grid with random values
-    outputWFC.resize(gridWidth, std::vector<Tiles>(gridHeight));
+    outputWFC.resize(gridHeight, std::vector<int>(gridWidth, -1));
     randomWFC();
 }
 
-const char* imagePaths[5] = {
-    "trackTiles/blank.png",
-    "trackTiles/down.png",
-    "trackTiles/left.png",
-    "trackTiles/right.png",
-    "trackTiles/up.png"
-};
+const char* tileSetPath = "trackTiles/tileset.txt";
 
 std::string loadShaderSource(const std::string& filePath) {
     std::ifstream file(filePath);
@@ -166,9 +162,6 @@ void setupShaders(GLuint& shaderProgram) {
 
 int main(void)
 {
-	//srand(static_cast<unsigned>(time(nullptr))); // Seed the random number generator
-    srand(1);
-
     GLFWwindow* window;
     initGLFW(&window);
 
@@ -183,9 +176,29 @@ int main(void)
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     /* Load and create a texture */
     //GLuint texture;
-    GLuint tileTextures[5]; // number of textures to generate, pointer to the texture ID   
-    glGenTextures(5, tileTextures);
-    for (int i = 0; i < 5; i++) {
+    try {
+        tileSet = TileSet::Load(tileSetPath);
+        if (!tileSet.analysis.Clean()) {
+            std::cerr << tileSetPath << ": rule analysis found";
+            if (!tileSet.analysis.asymmetricPairs.empty()) {
+                std::cerr << " " << tileSet.analysis.asymmetricPairs.size() << " asymmetric pair(s), removed";
+            }
+            if (!tileSet.analysis.deadEndTiles.empty()) {
+                std::cerr << (tileSet.analysis.asymmetricPairs.empty() ? " " : "; ") << tileSet.analysis.deadEndTiles.size()
+                    << " dead-end tile(s), kept but only placeable on the border";
+            }
+            std::cerr << std::endl;
+            tileSet.analysis.Print(std::cerr, tileSet.names);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Failed to load tileset: " << e.what() << std::endl;
+        return -1;
+    }
+
+    std::vector<GLuint> tileTextures(tileSet.TileCount()); // one texture per tile id
+    glGenTextures(tileSet.TileCount(), tileTextures.data());
+    for (int i = 0; i < tileSet.TileCount(); i++) {
         glBindTexture(GL_TEXTURE_2D, tileTextures[i]); // Bind the texture object to the target GL_TEXTURE_2D to do other stuff with
         
         // Set texture filtering/wrapping options
@@ -196,7 +209,7 @@ int main(void)
 
         // Load image data
         int width, height, nrChannels;
-        unsigned char* data = stbi_load(imagePaths[i], &width, &height, &nrChannels, 0);
+        unsigned char* data = stbi_load(tileSet.texturePaths[i].c_str(), &width, &height, &nrChannels, 0);
         if (data)
         {
             GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
@@ -205,7 +218,7 @@ int main(void)
         }
         else
         {
-            std::cerr << "Failed to load texture" << std::endl;
+            std::cerr << "Failed to load texture: " << tileSet.texturePaths[i] << std::endl;
         }
         stbi_image_free(data);
     }
@@ -215,11 +228,11 @@ int main(void)
     /// Set up vertex data and buffers and configure vertex attributes
     //////////////////////
 
-    float vertices[] = { //along with UVs
-     0.5f,  0.5f, 0.0f,  1.0f, 1.0f, // top right
-     0.5f, -0.5f, 0.0f,  1.0f, 0.0f, // bottom right
-    -0.5f, -0.5f, 0.0f,  0.0f, 0.0f, // bottom left
-    -0.5f,  0.5f, 0.0f,  0.0f, 1.0f // top left 
+    float vertices[] = { //along with UVs, v = 0 is the image's first (top) row as stb loads it
+     0.5f,  0.5f, 0.0f,  1.0f, 0.0f, // top right
+     0.5f, -0.5f, 0.0f,  1.0f, 1.0f, // bottom right
+    -0.5f, -0.5f, 0.0f,  0.0f, 1.0f, // bottom left
+    -0.5f,  0.5f, 0.0f,  0.0f, 0.0f // top left 
     };
     unsigned int indices[] = {  // note that we start from 0!
         0, 1, 3,   // first triangle
@@ -258,7 +271,7 @@ int main(void)
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 
-    wfc = std::make_unique<WFC>(gridWidth, gridHeight);
+    wfc = std::make_unique<WFC>(gridWidth, gridHeight, tileSet.rules, PropagationEngine::UNION, 1);
     newWFC();
 
     /* Loop until the user closes the window */
@@ -290,13 +303,21 @@ int main(void)
         for (int y = 0; y < gridHeight; ++y) {
             for (int x = 0; x < gridWidth; ++x) {
                 int flippedY = gridHeight - 1 - y;
-                int tileIndex = static_cast<int>(outputWFC[y][x]); // pick a texture index randomly
+                int tileIndex = outputWFC[y][x];
+                if (tileIndex < 0) continue; // not collapsed yet
 
                 // Create transform matrix
                 glm::mat4 model = glm::mat4(1.0f);
                 model = glm::translate(model, glm::vec3(100, 100, 0));
                 model = glm::translate(model, glm::vec3(x * tileSize * 1.05, flippedY * tileSize *1.05, 0.0f));
                 model = glm::scale(model, glm::vec3(tileSize, tileSize, 1.0f));
+                // Generated symmetry variants reuse their base tile's texture, turned clockwise (a
+                // negative angle with y up) after the mirror
+                const TileOrientation& orientation = tileSet.orientations[tileIndex];
+                model = glm::rotate(model, glm::radians(-90.0f * orientation.rotation), glm::vec3(0.0f, 0.0f, 1.0f));
+                if (orientation.reflected) {
+                    model = glm::scale(model, glm::vec3(-1.0f, 1.0f, 1.0f));
+                }
                 glm::mat4 transform = projection * model;
 
                 // Pass transform to shader